@@ -0,0 +1,186 @@
+// MidiMap.hpp
+
+// mapping of incoming MIDI notes and control changes to taps and continuous parameters.
+//
+// a map is text, with one binding per line and `#` comments:
+//   <note|cc> <channel> <number> tap <id>
+//   <note|cc> <channel> <number> fparam <id>
+//   <note|cc> <channel> <number> ifparam <id> <layer>
+// where channel 0 is any channel, and ids may be numbers or labels, as in the OSC interface.
+// a note-on, or a control change rising to 64 or more, fires a tap;
+// a parameter takes the velocity or controller value, scaled to [0, 1].
+// e.g. `cc 0 64 tap SET` for a sustain pedal, or `cc 1 7 ifparam PLAYBACK 0` for a fader
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "Mlp.hpp"
+
+enum class MidiSourceId : int {
+    Note,
+    Control,
+    Count
+};
+
+static constexpr char MidiSourceIdLabel[static_cast<int>(MidiSourceId::Count)][8] = {
+        "note",
+        "cc"
+};
+
+enum class MidiTargetId : int {
+    Tap,
+    FloatParam,
+    IndexFloatParam,
+    Count
+};
+
+static constexpr char MidiTargetIdLabel[static_cast<int>(MidiTargetId::Count)][8] = {
+        "tap",
+        "fparam",
+        "ifparam"
+};
+
+struct MidiBinding {
+    MidiSourceId source;
+    // 1-16, or 0 for any
+    uint8_t channel;
+    // note or controller number
+    uint8_t number;
+    MidiTargetId target;
+    // a `TapId`, `FloatParamId` or `IndexFloatParamId`
+    int id;
+    int layer;
+};
+
+class MidiMap {
+public:
+    static constexpr unsigned int maxBindings = 128;
+
+    // taps on notes 60-63 (any channel): set, stop, reset and retro-close
+    static constexpr char defaultText[] =
+            "note 0 60 tap SET\n"
+            "note 0 61 tap STOP\n"
+            "note 0 62 tap RESET\n"
+            "note 0 63 tap RETRO\n";
+
+    // replace the bindings; on error, returns false with a description, and leaves them unchanged
+    bool Parse(const std::string &text, std::string &error) {
+        MidiMap parsed;
+        std::istringstream lines(text);
+        std::string line;
+        unsigned int lineNumber = 0;
+        while (std::getline(lines, line)) {
+            ++lineNumber;
+            const auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            std::istringstream args(line);
+            std::string token;
+            if (!(args >> token)) {
+                continue;
+            }
+            if (parsed.numBindings == maxBindings) {
+                error = "more than " + std::to_string(maxBindings) + " bindings";
+                return false;
+            }
+            if (!ParseBinding(token, args, parsed.bindings[parsed.numBindings])) {
+                error = "line " + std::to_string(lineNumber) + ": can't parse '" + line + "'";
+                return false;
+            }
+            ++parsed.numBindings;
+        }
+        *this = parsed;
+        return true;
+    }
+
+    std::string Print() const {
+        std::ostringstream text;
+        for (unsigned int i = 0; i < numBindings; ++i) {
+            const MidiBinding &b = bindings[i];
+            text << MidiSourceIdLabel[static_cast<int>(b.source)] << ' ' << static_cast<int>(b.channel) << ' '
+                 << static_cast<int>(b.number) << ' ' << MidiTargetIdLabel[static_cast<int>(b.target)] << ' ';
+            switch (b.target) {
+                case MidiTargetId::Tap:
+                    text << mlp::Mlp::TapIdLabel[b.id];
+                    break;
+                case MidiTargetId::FloatParam:
+                    text << mlp::Mlp::FloatParamIdLabel[b.id];
+                    break;
+                case MidiTargetId::IndexFloatParam:
+                    text << mlp::Mlp::IndexFloatParamIdLabel[b.id] << ' ' << b.layer;
+                    break;
+                default:
+                    break;
+            }
+            text << '\n';
+        }
+        return text.str();
+    }
+
+    // call `f(binding)` for each binding of a message (with channel 1-16)
+    template<typename F>
+    void ForEach(MidiSourceId source, int channel, int number, F &&f) const {
+        for (unsigned int i = 0; i < numBindings; ++i) {
+            const MidiBinding &b = bindings[i];
+            if (b.source == source && b.number == number && (b.channel == 0 || b.channel == channel)) {
+                f(b);
+            }
+        }
+    }
+
+private:
+    std::array<MidiBinding, maxBindings> bindings{};
+    unsigned int numBindings{0};
+
+    template<int numIds, int labelSize>
+    static bool ParseId(const std::string &token, const char (&labels)[numIds][labelSize], int &id) {
+        for (int i = 0; i < numIds; ++i) {
+            if (token == labels[i]) {
+                id = i;
+                return true;
+            }
+        }
+        char *end;
+        const long int value = std::strtol(token.c_str(), &end, 10);
+        if (end == token.c_str() || *end != '\0' || value < 0 || value >= numIds) {
+            return false;
+        }
+        id = static_cast<int>(value);
+        return true;
+    }
+
+    static bool ParseBinding(const std::string &sourceToken, std::istringstream &args, MidiBinding &binding) {
+        int source, target, channel, number;
+        std::string token;
+        if (!ParseId(sourceToken, MidiSourceIdLabel, source)
+            || !(args >> channel) || channel < 0 || channel > 16
+            || !(args >> number) || number < 0 || number > 127
+            || !(args >> token) || !ParseId(token, MidiTargetIdLabel, target)
+            || !(args >> token)) {
+            return false;
+        }
+        binding.source = static_cast<MidiSourceId>(source);
+        binding.channel = static_cast<uint8_t>(channel);
+        binding.number = static_cast<uint8_t>(number);
+        binding.target = static_cast<MidiTargetId>(target);
+        binding.layer = 0;
+        switch (binding.target) {
+            case MidiTargetId::Tap:
+                return ParseId(token, mlp::Mlp::TapIdLabel, binding.id);
+            case MidiTargetId::FloatParam:
+                return ParseId(token, mlp::Mlp::FloatParamIdLabel, binding.id);
+            case MidiTargetId::IndexFloatParam:
+                return ParseId(token, mlp::Mlp::IndexFloatParamIdLabel, binding.id)
+                       && static_cast<bool>(args >> binding.layer)
+                       && binding.layer >= 0 && binding.layer < mlp::numLoopLayers;
+            default:
+                return false;
+        }
+    }
+};
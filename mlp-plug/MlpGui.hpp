@@ -100,7 +100,14 @@ class MlpGui : public juce::Component {
             setSliderStyle(juce::Slider::LinearBar);
             //setSliderStyle(juce::Slider::RotaryHorizontalDrag);
             setHelpText(aLabel);
-            setRange(0.0, 1.0, 0.001);
+            // the slider moves the normalized value; its text shows the value in the kernel's units.
+            // (unquantized, since a step would round away short fade and switch times)
+            setRange(0.0, 1.0);
+            const auto &param = mlp::Mlp::floatParamInfo[aParameterIndex];
+            setDoubleClickReturnValue(true, param.Normalize(param.defaultValue));
+            textFromValueFunction = [&param](double value) {
+                return juce::String(param.Map(static_cast<float>(value)), 3);
+            };
             //setValue(mlp.GetLayerParameter(layerIndex, parameterIndex));
             onValueChange = [=] {
                 // std::cout << "LayerParameterControl::onValueChange; layer = " << layerIndex << ", parameter = "
@@ -177,9 +184,9 @@ class MlpGui : public juce::Component {
                 modeButtons.push_back(std::move(but));
             };
 
-            addModeBut("ASYNC");
-            addModeBut("MULT");
-            addModeBut("INSERT");
+            for (const auto &label: mlp::LayerBehaviorModeIdLabel) {
+                addModeBut(label);
+            }
 
             addAndMakeVisible(space1);
             addAndMakeVisible(space2);
@@ -205,9 +212,9 @@ class MlpGui : public juce::Component {
             grid.templateColumns.add(juce::Grid::TrackInfo(juce::Grid::Px(tapButtonWidth / 2)));
 
             /// mode buttons
-            grid.templateColumns.add(juce::Grid::TrackInfo(juce::Grid::Px(tapButtonWidth)));
-            grid.templateColumns.add(juce::Grid::TrackInfo(juce::Grid::Px(tapButtonWidth)));
-            grid.templateColumns.add(juce::Grid::TrackInfo(juce::Grid::Px(tapButtonWidth)));
+            for (unsigned int i = 0; i < modeButtons.size(); ++i) {
+                grid.templateColumns.add(juce::Grid::TrackInfo(juce::Grid::Px(tapButtonWidth)));
+            }
 
             grid.items.add(juce::GridItem(space1));
 
@@ -339,12 +346,12 @@ class MlpGui : public juce::Component {
 
         //----------------------------------------------------------------------------------
         struct LayerParameterControlGroup
-                : public LayerWidgetControlGroup<LayerParameterControl, (size_t) mlp::Mlp::FloatParamId::Count, true, sliderHeight> {
+                : public LayerWidgetControlGroup<LayerParameterControl, (size_t) mlp::Mlp::IndexFloatParamId::Count, true, sliderHeight> {
 
             //std::vector<std::unique_ptr<juce::Label>> labels;
 
             explicit LayerParameterControlGroup(int layerIndex) {
-                for (int i = 0; i < (int) mlp::Mlp::FloatParamId::Count; ++i) {
+                for (int i = 0; i < (int) mlp::Mlp::IndexFloatParamId::Count; ++i) {
                     const std::string &label = mlp::Mlp::IndexFloatParamIdLabel[i];
                     controls.push_back(std::make_unique<LayerParameterControl>(layerIndex, i,
                                                                                mlp::Mlp::IndexFloatParamIdLabel[i]));
@@ -455,7 +462,7 @@ class MlpGui : public juce::Component {
                     Track(Px(buttonHeight)),
                     Track(Px(buttonHeight)),
                     Track(Px(buttonHeight)),
-                    Track(Px((sliderHeight+2)*5)),
+                    Track(Px((sliderHeight+2)*(int)mlp::Mlp::IndexFloatParamId::Count)),
                     Track(Px(sliderHeight)),
                     Track(Fr(1)),
             };
@@ -567,6 +574,12 @@ public:
         but->setToggleState(state, juce::NotificationType::dontSendNotification);
     }
 
+    // show a parameter's (normalized) value, without sending it
+    void SetLayerParameter(unsigned int layerIndex, unsigned int parameterIndex, float value) {
+        auto &slider = layerControlStack->layerControlGroups[layerIndex]->parameterControlGroup->controls[parameterIndex];
+        slider->setValue(value, juce::NotificationType::dontSendNotification);
+    }
+
     void SetLayerSelection(unsigned int layerIndex) {
         for (unsigned int i = 0; i < mlp::numLoopLayers; ++i) {
             layerControlStack->layerControlGroups[i]->selectedToggle->setToggleState(layerIndex == i,
@@ -603,9 +616,10 @@ public:
             layer->modeControlGroup->controls[1]->setToggleState(true, juce::NotificationType::dontSendNotification);
             layer->toggleControlGroup->controls[(int)mlp::Mlp::IndexBoolParamId::LayerReadEnabled]->setToggleState(true, juce::NotificationType::dontSendNotification);
             layer->toggleControlGroup->controls[(int)mlp::Mlp::IndexBoolParamId::LayerLoopEnabled]->setToggleState(true, juce::NotificationType::dontSendNotification);
-            layer->parameterControlGroup->controls[(int)mlp::Mlp::IndexFloatParamId::LayerPlaybackLevel]->setValue(1.0);
-            layer->parameterControlGroup->controls[(int)mlp::Mlp::IndexFloatParamId::LayerRecordLevel]->setValue(1.0);
-            layer->parameterControlGroup->controls[(int)mlp::Mlp::IndexFloatParamId::LayerPreserveLevel]->setValue(1.0);
+            for (int i = 0; i < (int) mlp::Mlp::IndexFloatParamId::Count; ++i) {
+                const auto &param = mlp::Mlp::floatParamInfo[i];
+                layer->parameterControlGroup->controls[i]->setValue(param.Normalize(param.defaultValue));
+            }
         }
     }
 };
@@ -3,19 +3,43 @@
 
 //==============================================================================
 AudioPluginAudioProcessorEditor::AudioPluginAudioProcessorEditor (AudioPluginAudioProcessor& p)
-    : AudioProcessorEditor (&p), processorRef (p), editorInput(p.mlp, mlpGui), editorOutput(p.mlp)
+    : AudioProcessorEditor (&p), processorRef (p), editorInput(p.mlp, mlpGui), editorOutput(p)
 {
     juce::ignoreUnused (processorRef);
 
     addAndMakeVisible(mlpGui);
+    addAndMakeVisible(midiMapButton);
+    midiMapButton.onClick = [this] { LoadMidiMap(); };
     setSize (1200, 800);
     mlpGui.SetOutput(&editorOutput);
+    for (unsigned int layer = 0; layer < mlp::numLoopLayers; ++layer) {
+        for (unsigned int i = 0; i < static_cast<unsigned int>(mlp::Mlp::IndexFloatParamId::Count); ++i) {
+            mlpGui.SetLayerParameter(layer, i, p.GetLayerParameter(static_cast<mlp::Mlp::IndexFloatParamId>(i), layer)->get());
+        }
+    }
 }
 
 AudioPluginAudioProcessorEditor::~AudioPluginAudioProcessorEditor()
 {
 }
 
+void AudioPluginAudioProcessorEditor::LoadMidiMap()
+{
+    midiMapChooser = std::make_unique<juce::FileChooser>("load MIDI map", juce::File(), "*.txt");
+    midiMapChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                [this](const juce::FileChooser &chooser) {
+        const auto file = chooser.getResult();
+        if (file == juce::File()) {
+            return;
+        }
+        std::string error;
+        if (!processorRef.SetMidiMap(file.loadFileAsString().toStdString(), error)) {
+            juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon, "MIDI map",
+                                                   file.getFileName() + ": " + error);
+        }
+    });
+}
+
 /*
  * juce::Typeface::Ptr getTypefaceForFont(const juce::Font& f) override
 {
@@ -36,5 +60,7 @@ void AudioPluginAudioProcessorEditor::paint (juce::Graphics& g)
 
 void AudioPluginAudioProcessorEditor::resized()
 {
-    mlpGui.setBounds (getBoundsInParent());
+    auto bounds = getLocalBounds();
+    midiMapButton.setBounds (bounds.removeFromBottom (24).removeFromRight (120));
+    mlpGui.setBounds (bounds);
 }
@@ -119,10 +119,11 @@ private:
     };  // EditorInput
 
     class EditorOutput: public MlpGuiOutput {
+        AudioPluginAudioProcessor &processor;
         mlp::Mlp &mlp;
 
     public:
-        explicit EditorOutput(mlp::Mlp &aMlp) : mlp(aMlp) {}
+        explicit EditorOutput(AudioPluginAudioProcessor &aProcessor) : processor(aProcessor), mlp(aProcessor.mlp) {}
 
         void SendTap(mlp::Mlp::TapId id) override {
             mlp.Tap(id);
@@ -144,8 +145,9 @@ private:
             mlp.IndexIndexParamChange(id, index, indexindex);
         }
 
+        // through the host parameter, which tells the engine, so the host sees the change
         void SendIndexFloat(mlp::Mlp::IndexFloatParamId id, unsigned int index, float value) override {
-            mlp.IndexFloatParamChange(id, index, value);
+            processor.GetLayerParameter(id, index)->setValueNotifyingHost(value);
         }
 
     };
@@ -157,5 +159,11 @@ private:
     EditorInput editorInput;
     EditorOutput editorOutput;
 
+    // loads a MIDI map file (see MidiMap.hpp)
+    juce::TextButton midiMapButton{"MIDI MAP..."};
+    std::unique_ptr<juce::FileChooser> midiMapChooser;
+
+    void LoadMidiMap();
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioPluginAudioProcessorEditor)
 };
@@ -9,11 +9,80 @@ AudioPluginAudioProcessor::AudioPluginAudioProcessor()
 ),
           inputBuffer(initialBufferSize),
           outputBuffer(initialBufferSize) {
+    constexpr int numLayerParams = static_cast<int>(mlp::Mlp::IndexFloatParamId::Count);
+    for (int layer = 0; layer < mlp::numLoopLayers; ++layer) {
+        for (int i = 0; i < numLayerParams; ++i) {
+            AddFloatParameter(static_cast<mlp::Mlp::FloatParamId>(i), layer);
+        }
+    }
+    for (int i = numLayerParams; i < static_cast<int>(mlp::Mlp::FloatParamId::Count); ++i) {
+        AddFloatParameter(static_cast<mlp::Mlp::FloatParamId>(i), -1);
+    }
+    std::string error;
+    midiMap.Parse(MidiMap::defaultText, error);
+    audioMidiMap = midiMap;
 }
 
 AudioPluginAudioProcessor::~AudioPluginAudioProcessor() {
 }
 
+void AudioPluginAudioProcessor::AddFloatParameter(mlp::Mlp::FloatParamId id, int layer) {
+    const auto &info = mlp::Mlp::floatParamInfo[static_cast<int>(id)];
+    juce::String paramId = juce::String(info.label).toLowerCase();
+    juce::String name = info.label;
+    if (layer >= 0) {
+        paramId << "_" << layer;
+        name = "L" + juce::String(layer + 1) + " " + name;
+    }
+    auto *parameter = new juce::AudioParameterFloat(
+            juce::ParameterID{paramId, 1}, name,
+            juce::NormalisableRange<float>(0.f, 1.f), info.Normalize(info.defaultValue),
+            juce::AudioParameterFloatAttributes().withStringFromValueFunction([&info](float value, int) {
+                return juce::String(info.Map(value), 3);
+            }));
+    parameter->addListener(this);
+    addParameter(parameter);
+    floatParamBindings.push_back({id, layer});
+    floatParameters.push_back(parameter);
+}
+
+juce::AudioParameterFloat *AudioPluginAudioProcessor::GetLayerParameter(mlp::Mlp::IndexFloatParamId id,
+                                                                        unsigned int layer) {
+    return floatParameters[layer * static_cast<unsigned int>(mlp::Mlp::IndexFloatParamId::Count)
+                           + static_cast<unsigned int>(id)];
+}
+
+juce::AudioParameterFloat *AudioPluginAudioProcessor::FindFloatParameter(mlp::Mlp::FloatParamId id, int layer) {
+    for (size_t i = 0; i < floatParamBindings.size(); ++i) {
+        if (floatParamBindings[i].id == id && floatParamBindings[i].layer == layer) {
+            return floatParameters[i];
+        }
+    }
+    return nullptr;
+}
+
+bool AudioPluginAudioProcessor::SetMidiMap(const std::string &text, std::string &error) {
+    if (!midiMap.Parse(text, error)) {
+        return false;
+    }
+    midiMapQ.enqueue(midiMap);
+    return true;
+}
+
+void AudioPluginAudioProcessor::parameterValueChanged(int parameterIndex, float newValue) {
+    const auto &binding = floatParamBindings[static_cast<size_t>(parameterIndex)];
+    if (binding.layer < 0) {
+        mlp.FloatParamChange(binding.id, newValue);
+    } else {
+        mlp.IndexFloatParamChange(static_cast<mlp::Mlp::IndexFloatParamId>(binding.id),
+                                  static_cast<unsigned int>(binding.layer), newValue);
+    }
+}
+
+void AudioPluginAudioProcessor::parameterGestureChanged(int parameterIndex, bool gestureIsStarting) {
+    juce::ignoreUnused(parameterIndex, gestureIsStarting);
+}
+
 //==============================================================================
 const juce::String AudioPluginAudioProcessor::getName() const {
     return JucePlugin_Name;
@@ -71,7 +140,12 @@ void AudioPluginAudioProcessor::changeProgramName(int index, const juce::String
 
 //==============================================================================
 void AudioPluginAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock) {
-    juce::ignoreUnused(sampleRate, samplesPerBlock);
+    juce::ignoreUnused(samplesPerBlock);
+    mlp.SetSampleRate(static_cast<float>(sampleRate));
+    // times are in seconds, so (re)apply every parameter at the new rate
+    for (size_t i = 0; i < floatParameters.size(); ++i) {
+        parameterValueChanged(static_cast<int>(i), floatParameters[i]->get());
+    }
 }
 
 void AudioPluginAudioProcessor::releaseResources() {
@@ -107,10 +181,10 @@ void AudioPluginAudioProcessor::InterleaveInput(const float* srcL, const float*
         while (sz < numSamples) sz <<= 1;
         inputBuffer.resize(sz);
     }
-    float* dst = inputBuffer.data();
+    mlp::AudioSample* dst = inputBuffer.data();
     for (unsigned int i = 0; i < numSamples; ++i) {
-        *dst++ = *srcL++;
-        *dst++ = *srcR++;
+        *dst++ = mlp::FromFloat<mlp::AudioSample>(*srcL++);
+        *dst++ = mlp::FromFloat<mlp::AudioSample>(*srcR++);
     }
 }
 
@@ -122,18 +196,67 @@ void AudioPluginAudioProcessor::InterleaveOutput(float *dstL, float *dstR, unsig
         while (sz < numSamples) sz <<= 1;
         outputBuffer.resize(sz);
     }
-    float* src = outputBuffer.data();
+    const mlp::AudioSample* src = outputBuffer.data();
     for (unsigned int i = 0; i < numSamples; ++i) {
-        *dstL++ = *src++;
-        *dstR++ = *src++;
+        *dstL++ = mlp::ToFloat(*src++);
+        *dstR++ = mlp::ToFloat(*src++);
     }
 }
 
 
+template<typename F>
+void AudioPluginAudioProcessor::HandleMidiMessage(const juce::MidiMessage &message, F &&split) {
+    MidiSourceId source;
+    int number, value;
+    if (message.isNoteOn()) {
+        source = MidiSourceId::Note;
+        number = message.getNoteNumber();
+        value = message.getVelocity();
+    } else if (message.isController()) {
+        source = MidiSourceId::Control;
+        number = message.getControllerNumber();
+        value = message.getControllerValue();
+    } else {
+        return;
+    }
+    const int channel = message.getChannel();
+    int lastValue = 0;
+    if (source == MidiSourceId::Control) {
+        auto &last = lastControlValue[static_cast<size_t>(channel - 1)][static_cast<size_t>(number)];
+        lastValue = last;
+        last = static_cast<uint8_t>(value);
+    }
+    const float normalizedValue = static_cast<float>(value) / 127.f;
+
+    audioMidiMap.ForEach(source, channel, number, [&](const MidiBinding &binding) {
+        switch (binding.target) {
+            case MidiTargetId::Tap:
+                if (source == MidiSourceId::Note || (value >= 64 && lastValue < 64)) {
+                    split();
+                    mlp.ApplyTap(static_cast<mlp::Mlp::TapId>(binding.id));
+                }
+                break;
+            case MidiTargetId::FloatParam:
+            case MidiTargetId::IndexFloatParam: {
+                split();
+                const auto id = static_cast<mlp::Mlp::FloatParamId>(binding.id);
+                const int layer = binding.target == MidiTargetId::IndexFloatParam ? binding.layer : -1;
+                // through the host parameter where there is one, which tells the engine at once
+                if (auto *parameter = FindFloatParameter(id, layer)) {
+                    parameter->setValueNotifyingHost(normalizedValue);
+                } else {
+                    mlp.FloatParamChange(id, normalizedValue);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    });
+}
+
 void AudioPluginAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                              juce::MidiBuffer &midiMessages) {
-    juce::ignoreUnused(midiMessages);
-
     juce::ScopedNoDenormals noDenormals;
 
     auto totalNumInputChannels = getTotalNumInputChannels();
@@ -152,8 +275,24 @@ void AudioPluginAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
     float *dstL = buffer.getWritePointer(0);
     float *dstR = buffer.getWritePointer(totalNumOutputChannels > 1 ? 1 : 0);
 
+    while (midiMapQ.try_dequeue(audioMidiMap)) {}
+
     InterleaveInput(srcL, srcR, numFrames);
-    mlp.ProcessAudioBlock(inputBuffer.data(), outputBuffer.data(), numFrames);
+    // split the block at each mapped message, so it takes effect on its own frame
+    unsigned int frame = 0;
+    auto processTo = [&](unsigned int end) {
+        if (end > frame) {
+            mlp.ProcessAudioBlock(inputBuffer.data() + frame * mlp::numLoopChannels,
+                                  outputBuffer.data() + frame * mlp::numLoopChannels, end - frame);
+            frame = end;
+        }
+    };
+    for (const auto metadata: midiMessages) {
+        const auto offset = static_cast<unsigned int>(juce::jlimit(0, static_cast<int>(numFrames),
+                                                                   metadata.samplePosition));
+        HandleMidiMessage(metadata.getMessage(), [&] { processTo(offset); });
+    }
+    processTo(numFrames);
     InterleaveOutput(dstL, dstR, numFrames);
 }
 
@@ -168,11 +307,30 @@ juce::AudioProcessorEditor *AudioPluginAudioProcessor::createEditor() {
 
 //==============================================================================
 void AudioPluginAudioProcessor::getStateInformation(juce::MemoryBlock &destData) {
-    juce::ignoreUnused(destData);
+    juce::XmlElement state("MLP");
+    for (const auto *parameter: floatParameters) {
+        state.setAttribute(parameter->paramID, parameter->get());
+    }
+    state.createNewChildElement("MIDIMAP")->addTextElement(midiMap.Print());
+    copyXmlToBinary(state, destData);
 }
 
 void AudioPluginAudioProcessor::setStateInformation(const void *data, int sizeInBytes) {
-    juce::ignoreUnused(data, sizeInBytes);
+    const auto state = getXmlFromBinary(data, sizeInBytes);
+    if (state == nullptr || !state->hasTagName("MLP")) {
+        return;
+    }
+    for (auto *parameter: floatParameters) {
+        if (state->hasAttribute(parameter->paramID)) {
+            parameter->setValueNotifyingHost(static_cast<float>(state->getDoubleAttribute(parameter->paramID)));
+        }
+    }
+    if (const auto *map = state->getChildByName("MIDIMAP")) {
+        std::string error;
+        if (!SetMidiMap(map->getAllSubText().toStdString(), error)) {
+            DBG("can't restore MIDI map: " << error);
+        }
+    }
 }
 
 //==============================================================================
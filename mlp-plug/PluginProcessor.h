@@ -3,9 +3,11 @@
 #include <juce_audio_processors/juce_audio_processors.h>
 
 #include "Mlp.hpp"
+#include "MidiMap.hpp"
 
 //==============================================================================
-class AudioPluginAudioProcessor final : public juce::AudioProcessor {
+class AudioPluginAudioProcessor final : public juce::AudioProcessor,
+                                        private juce::AudioProcessorParameter::Listener {
 public:
     friend class AudioPluginAudioProcessorEditor;
 
@@ -57,8 +59,47 @@ public:
 
     void setStateInformation(const void *data, int sizeInBytes) override;
 
+    //==============================================================================
+    juce::AudioParameterFloat *GetLayerParameter(mlp::Mlp::IndexFloatParamId id, unsigned int layer);
+
+    // replace the MIDI mapping (see MidiMap.hpp), from the message thread.
+    // on error, returns false with a description, and keeps the current mapping
+    bool SetMidiMap(const std::string &text, std::string &error);
+
 private:
     mlp::Mlp mlp;
+
+    // host parameters, made from the engine's parameter registry:
+    // each per-layer parameter for each layer in turn, then the global parameters
+    struct FloatParamBinding {
+        mlp::Mlp::FloatParamId id;
+        // negative for a global parameter
+        int layer;
+    };
+    std::vector<FloatParamBinding> floatParamBindings;
+    std::vector<juce::AudioParameterFloat *> floatParameters;
+
+    void AddFloatParameter(mlp::Mlp::FloatParamId id, int layer);
+
+    // forward a host parameter's (normalized) value to the engine, from any thread
+    void parameterValueChanged(int parameterIndex, float newValue) override;
+
+    void parameterGestureChanged(int parameterIndex, bool gestureIsStarting) override;
+
+    // the host parameter for a parameter on a layer (or a global parameter, with a negative layer);
+    // null for the global form of a per-layer parameter, which has none
+    juce::AudioParameterFloat *FindFloatParameter(mlp::Mlp::FloatParamId id, int layer);
+
+    // the message thread's mapping is the one saved; each change is sent to the audio thread's copy
+    MidiMap midiMap;
+    MidiMap audioMidiMap;
+    moodycamel::ReaderWriterQueue<MidiMap> midiMapQ;
+    // last value of each controller on each channel, so taps fire on a rising edge
+    std::array<std::array<uint8_t, 128>, 16> lastControlValue{};
+
+    // apply a message's bindings, calling `split()` before the first
+    template<typename F>
+    void HandleMidiMessage(const juce::MidiMessage &message, F &&split);
     //// FIXME:
     /// rather bad hack here:
     /// the processor assumes stereo interleaved I/O.
@@ -67,8 +108,9 @@ private:
     /// so, maintaining a stereo interleaved buffer for each direction.
     /// we will allow it to grow on the audio thread, which is not great, but hopefully will not happen often
     static constexpr size_t initialBufferSize = 2048;
-    std::vector<float> inputBuffer;
-    std::vector<float> outputBuffer;
+    // interleaved, in the engine's sample format
+    std::vector<mlp::AudioSample> inputBuffer;
+    std::vector<mlp::AudioSample> outputBuffer;
 
     void InterleaveInput(const float *srcL, const float *srcR, unsigned int numSamples);
 
@@ -2,6 +2,8 @@
 
 #include "readerwriterqueue/readerwriterqueue.h"
 #include "mlp/Kernel.hpp"
+#include "mlp/ParamRegistry.hpp"
+#include "mlp/ParamStore.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wswitch-enum"
@@ -20,13 +22,17 @@ namespace mlp {
             Set,
             Stop,
             Reset,
+            RetroClose,
+            MeasureLatency,
             Count
         };
 
         static constexpr char TapIdLabel[static_cast<int>(TapId::Count)][16] = {
                 "SET",
                 "STOP",
-                "RESET"
+                "RESET",
+                "RETRO",
+                "PING"
         };
 
         enum class FloatParamId : int {
@@ -35,33 +41,72 @@ namespace mlp {
             PlaybackLevel,
             FadeTime,
             SwitchTime,
+            Pan,
+            Width,
+            Balance,
+            SmoothTime,
+            ReadOffset,
+            TapOffset,
             Count
         };
 
-        static constexpr char FloatParamIdLabel[static_cast<int>(FloatParamId::Count)][16] = {
-                "PRESERVE",
-                "RECORD",
-                "PLAYBACK",
-                "FADE",
-                "SWITCH"
+        // the registry of continuous parameters, in `FloatParamId` order; per-layer parameters come first,
+        // and are also the `IndexFloatParamId`s. labels, host parameters, sliders and setters are all made from it
+        static constexpr FloatParamInfo floatParamInfo[static_cast<int>(FloatParamId::Count)] = {
+                {"PRESERVE", 0.f, 1.f, 1.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetPreserveLevel(v, layer); }},
+                {"RECORD", 0.f, 1.f, 1.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetRecordLevel(v, layer); }},
+                {"PLAYBACK", 0.f, 1.f, 1.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetPlaybackLevel(v, layer); }},
+                // (the kernel starts with 100-frame fades and switches, about 2ms at 48k;
+                // the kernel divides by these times, so they stop short of zero)
+                {"FADE", 0.001f, 10.f, 0.002f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetFadeTime(v, layer); }},
+                {"SWITCH", 0.001f, 10.f, 0.002f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetSwitchTime(v, layer); }},
+                // stereo field params are bipolar (or [0, 2] for width) in the kernel
+                {"PAN", -1.f, 1.f, 0.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetPan(v, layer); }},
+                {"WIDTH", 0.f, 2.f, 1.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetWidth(v, layer); }},
+                {"BALANCE", -1.f, 1.f, 0.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetBalance(v, layer); }},
+                {"SMOOTH", 0.f, 1.f, 0.02f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetLevelSmoothTime(v, layer); }},
+                {"OFFSET", 0.f, 1.f, 0.f, 1.f, ParamScope::Layer,
+                 [](Kernel &k, float v, int layer) { k.SetReadOffsetTime(v, layer); }},
+                // taps may be moved earlier or later
+                {"TAPOFFSET", -1.f, 1.f, 0.f, 1.f, ParamScope::Global,
+                 [](Kernel &k, float v, int) { k.SetTapOffsetTime(v); }}
         };
 
+        static constexpr auto floatParamLabels =
+                MakeLabelTable<static_cast<int>(FloatParamId::Count), 16>(floatParamInfo);
+        static constexpr const char (&FloatParamIdLabel)[static_cast<int>(FloatParamId::Count)][16] =
+                floatParamLabels.labels;
+
         enum class IndexFloatParamId : int {
             LayerPreserveLevel,
             LayerRecordLevel,
             LayerPlaybackLevel,
             LayerFadeTime,
             LayerSwitchTime,
+            LayerPan,
+            LayerWidth,
+            LayerBalance,
+            LayerSmoothTime,
+            LayerReadOffset,
             Count
         };
 
-        static constexpr char IndexFloatParamIdLabel[static_cast<int>(IndexFloatParamId::Count)][32] = {
-                "PRESERVE",
-                "RECORD",
-                "PLAYBACK",
-                "FADE",
-                "SWITCH"
-        };
+        static_assert(AreLayerParamsFirst(floatParamInfo, static_cast<int>(IndexFloatParamId::Count)),
+                      "IndexFloatParamId must name the per-layer parameters");
+
+        static constexpr auto indexFloatParamLabels =
+                MakeLabelTable<static_cast<int>(IndexFloatParamId::Count), 32>(floatParamInfo);
+        static constexpr const char (&IndexFloatParamIdLabel)[static_cast<int>(IndexFloatParamId::Count)][32] =
+                indexFloatParamLabels.labels;
 
         struct IndexFloatParamValue {
             unsigned int index;
@@ -76,6 +121,11 @@ namespace mlp {
             LoopStartFrame,
             LoopEndFrame,
             LoopResetFrame,
+            SmoothMode,
+            RetroPreRollFrames,
+            CaptureLoopFrames,
+            InputLatencyFrames,
+            OutputLatencyFrames,
             Count
         };
 
@@ -86,7 +136,12 @@ namespace mlp {
                 "RESTART",
                 "STARTPOS",
                 "ENDPOS",
-                "RESETPOS"
+                "RESETPOS",
+                "SMOOTHMODE",
+                "PREROLL",
+                "CAPTURE",
+                "INLATENCY",
+                "OUTLATENCY"
         };
 
         enum class IndexIndexParamId : int {
@@ -94,6 +149,8 @@ namespace mlp {
             LayerLoopStartFrame,
             LayerLoopEndFrame,
             LayerLoopResetFrame,
+            LayerSmoothMode,
+            LayerReadOffsetFrames,
             Count
         };
 
@@ -101,7 +158,9 @@ namespace mlp {
                 "MODE",
                 "STARTPOS",
                 "ENDPOS",
-                "RESETPOS"
+                "RESETPOS",
+                "SMOOTHMODE",
+                "OFFSETPOS"
         };
 
         struct IndexIndexParamValue {
@@ -144,6 +203,22 @@ namespace mlp {
             bool value;
         };
 
+        // routes an action on a layer's condition to a set of target layers
+        struct LayerRouteValue {
+            unsigned int index;
+            LayerConditionId condition;
+            LayerActionId action;
+            LayerMask targets;
+        };
+
+        // sets the firing count of an action on a layer's condition
+        struct LayerCountValue {
+            unsigned int index;
+            LayerConditionId condition;
+            LayerActionId action;
+            int count;
+        };
+
         template<typename Id, typename Value>
         struct ParamChangeRequest {
             Id id;
@@ -152,16 +227,30 @@ namespace mlp {
 
     private:
 
+        static constexpr unsigned int maxLiveBehaviors = 16;
+
         struct ParamChangeQ {
             EventQueue<TapId> tapQ;
-            EventQueue<ParamChangeRequest<FloatParamId, float>> floatQ;
             EventQueue<ParamChangeRequest<IndexParamId, unsigned long int>> indexQ;
             EventQueue<ParamChangeRequest<BoolParamId, bool>> boolQ;
-            EventQueue<ParamChangeRequest<IndexFloatParamId, IndexFloatParamValue>> indexFloatQ;
             EventQueue<ParamChangeRequest<IndexIndexParamId, IndexIndexParamValue>> indexIndexQ;
             EventQueue<ParamChangeRequest<IndexBoolParamId, IndexBoolParamValue>> indexBoolQ;
+            EventQueue<LayerRouteValue> layerRouteQ;
+            EventQueue<LayerCountValue> layerCountQ;
+            // compiled behavior programs, and programs which the audio thread is finished with.
+            // programs are allocated and deleted on the control thread only, which keeps no more than
+            // `maxLiveBehaviors` alive, so retiring one on the audio thread always has room
+            EventQueue<BehaviorProgram *> behaviorQ{maxLiveBehaviors};
+            EventQueue<BehaviorProgram *> retiredBehaviorQ{maxLiveBehaviors};
         };
         ParamChangeQ paramChangeQ;
+        // programs allocated and not yet deleted (control thread only)
+        unsigned int numLiveBehaviors{0};
+
+        // continuous parameters skip the queues: only the latest value per block matters.
+        // per-layer values are in slot (id * numLoopLayers + layer)
+        ParamStore<static_cast<unsigned int>(FloatParamId::Count)> floatParams;
+        ParamStore<static_cast<unsigned int>(IndexFloatParamId::Count) * numLoopLayers> indexFloatParams;
 
         struct OutputsQ {
             EventQueue<mlp::LayerFlagsMessageData> layerFlagsQ;
@@ -172,21 +261,38 @@ namespace mlp {
         Kernel kernel;
         mlp::OutputsData outputsData;
         unsigned long int framesSinceOutput = 0;
+        // output peak level per channel over the current output period, and over the last complete one
+        AudioSample outputPeak[numLoopChannels]{};
+        std::atomic<float> lastOutputPeak[numLoopChannels]{};
+        // number of output periods published; lets a reader wait for new outputs instead of polling
+        std::atomic<unsigned long int> outputPeriodCount{0};
 
         float sampleRate;
 
     public:
-        void SetSampleRate(float aSampleRate) { sampleRate = aSampleRate; }
+        ~Mlp() {
+            BehaviorProgram *program;
+            while (paramChangeQ.behaviorQ.try_dequeue(program)) {
+                delete program;
+            }
+            while (paramChangeQ.retiredBehaviorQ.try_dequeue(program)) {
+                delete program;
+            }
+        }
+
+        void SetSampleRate(float aSampleRate) {
+            sampleRate = aSampleRate;
+            kernel.SetSampleRate(aSampleRate);
+        }
 
-        void ProcessAudioBlock(const float *input, float *output, unsigned int numFrames) {
+        // interleaved stereo, in the engine's sample format (float unless built with MLP_SAMPLE_FORMAT=Fixed)
+        void ProcessAudioBlock(const AudioSample *input, AudioSample *output, unsigned int numFrames) {
 
             ProcessParamChanges();
 
-            for (unsigned int i = 0; i < numFrames; ++i) {
-                *output = 0.f;
-                *(output + 1) = 0.f;
-                kernel.ProcessFrame(input, output);
-            }
+            kernel.ProcessBlock(input, output, numFrames);
+
+            MeasureOutputPeak(output, numFrames);
 
             ProcessOutputs(numFrames);
         }
@@ -199,8 +305,34 @@ namespace mlp {
             return outputsQ.layerPositionQ;
         }
 
+        // peak output level of the given channel over the last output period
+        float GetOutputPeak(unsigned int channel) const {
+            return lastOutputPeak[channel].load(std::memory_order_relaxed);
+        }
+
+        // increases each time the output queues (and peaks) are updated, i.e. every `framesPerOutput` frames
+        unsigned long int GetOutputPeriodCount() const {
+            return outputPeriodCount.load(std::memory_order_acquire);
+        }
+
+        // condition/action trace; enable it, and read events from it, on a control thread
+        Trace &GetTrace() {
+            return kernel.GetTrace();
+        }
+
     private:
 
+        void MeasureOutputPeak(const AudioSample *output, unsigned int numFrames) {
+            for (unsigned int i = 0; i < numFrames; ++i) {
+                for (unsigned int ch = 0; ch < numLoopChannels; ++ch) {
+                    const AudioSample x = LoopFormat::Magnitude(output[i * numLoopChannels + ch]);
+                    if (x > outputPeak[ch]) {
+                        outputPeak[ch] = x;
+                    }
+                }
+            }
+        }
+
         void ProcessOutputs(unsigned int numFrames) {
             framesSinceOutput += numFrames;
             if (framesSinceOutput >= framesPerOutput) {
@@ -215,184 +347,74 @@ namespace mlp {
                             {i, {outputsData.layers[i].positionRange[0], outputsData.layers[i].positionRange[1]}});
                 }
                 kernel.InitializeOutputs(&outputsData);
+                for (unsigned int ch = 0; ch < numLoopChannels; ++ch) {
+                    lastOutputPeak[ch].store(ToFloat(outputPeak[ch]), std::memory_order_relaxed);
+                    outputPeak[ch] = AudioSample{};
+                }
+                outputPeriodCount.fetch_add(1, std::memory_order_release);
             }
         }
 
         void ProcessParamChanges() {
             TapId tapId;
             while (paramChangeQ.tapQ.try_dequeue(tapId)) {
-                switch (tapId) {
-                    case TapId::Set:
-                        kernel.SetLoopTap();
-                        break;
-                    case TapId::Stop:
-                        kernel.StopLoop();
-                        break;
-                    case TapId::Reset:
-                        kernel.ResetLayer();
-                        break;
-                    default:
-                        break;
-                }
+                ApplyTap(tapId);
             }
 
-            ParamChangeRequest<FloatParamId, float> floatParamChangeRequest{};
-            while (paramChangeQ.floatQ.try_dequeue(floatParamChangeRequest)) {
-                switch (floatParamChangeRequest.id) {
-                    case FloatParamId::PreserveLevel:
-                        kernel.SetPreserveLevel(floatParamChangeRequest.value);
-                        break;
-                    case FloatParamId::RecordLevel:
-                        kernel.SetRecordLevel(floatParamChangeRequest.value);
-                        break;
-                    case FloatParamId::PlaybackLevel:
-                        kernel.SetPlaybackLevel(floatParamChangeRequest.value);
-                        break;
-                    case FloatParamId::FadeTime:
-/// FIXME: need a more formal/ explicit way of specifying parameter range mappings
-                        kernel.SetFadeTime(floatParamChangeRequest.value * 10.f);
-                        break;
-                    case FloatParamId::SwitchTime:
-/// FIXME: need a more formal/ explicit way of specifying parameter range mappings
-                        kernel.SetSwitchTime(floatParamChangeRequest.value * 10.f);
-                        break;
-                    default:
-                        break;
-                }
-            }
+            // (global values first, so a layer's own value set in the same block wins)
+            floatParams.Consume([this](unsigned int slot, float value) {
+                const FloatParamInfo &param = floatParamInfo[slot];
+                param.set(kernel, param.Map(value), -1);
+            });
+            indexFloatParams.Consume([this](unsigned int slot, float value) {
+                const FloatParamInfo &param = floatParamInfo[slot / numLoopLayers];
+                param.set(kernel, param.Map(value), static_cast<int>(slot % numLoopLayers));
+            });
 
             ParamChangeRequest<IndexParamId, unsigned long int> indexParamChangeRequest{};
             while (paramChangeQ.indexQ.try_dequeue(indexParamChangeRequest)) {
-                switch (indexParamChangeRequest.id) {
-                    case IndexParamId::Mode:
-                        kernel.SetMode(static_cast<LayerBehaviorModeId>(indexParamChangeRequest.value));
-                        break;
-                    case IndexParamId::SelectLayer:
-                        kernel.SetCurrentLayer((unsigned int) indexParamChangeRequest.value);
-                        break;
-                    case IndexParamId::ResetLayer:
-                        kernel.ResetLayer((int) indexParamChangeRequest.value);
-                        break;
-                    case IndexParamId::RestartLayer:
-                        kernel.RestartLayer((int) indexParamChangeRequest.value);
-                        break;
-                    case IndexParamId::LoopStartFrame:
-                        kernel.SetLoopStartFrame(indexParamChangeRequest.value);
-                        break;
-                    case IndexParamId::LoopEndFrame:
-                        kernel.SetLoopEndFrame(indexParamChangeRequest.value);
-                        break;
-                    case IndexParamId::LoopResetFrame:
-                        kernel.SetLoopResetFrame(indexParamChangeRequest.value);
-                        break;
-                    default:
-                        break;
-                }
+                ApplyIndexParam(indexParamChangeRequest.id, indexParamChangeRequest.value);
             }
 
             ParamChangeRequest<BoolParamId, bool> boolParamChangeRequest{};
             while (paramChangeQ.boolQ.try_dequeue(boolParamChangeRequest)) {
-                switch (boolParamChangeRequest.id) {
-                    case BoolParamId::WriteEnabled:
-                        kernel.SetWrite(boolParamChangeRequest.value);
-                        break;
-                    case BoolParamId::ClearEnabled:
-                        kernel.SetClear(boolParamChangeRequest.value);
-                        break;
-                    case BoolParamId::ReadEnabled:
-                        kernel.SetRead(boolParamChangeRequest.value);
-                        break;
-                    case BoolParamId::LoopEnabled:
-                        kernel.SetLoopEnabled(boolParamChangeRequest.value);
-                        break;
-                    default:
-                        break;
-                }
-            }
-
-            ParamChangeRequest<IndexFloatParamId, IndexFloatParamValue> indexFloatParamChangeRequest{};
-            while (paramChangeQ.indexFloatQ.try_dequeue(indexFloatParamChangeRequest)) {
-                float tmpValue;
-                switch (indexFloatParamChangeRequest.id) {
-                    case IndexFloatParamId::LayerPreserveLevel:
-                        kernel.SetPreserveLevel(indexFloatParamChangeRequest.value.value,
-                                                (int) indexFloatParamChangeRequest.value.index);
-                        break;
-                    case IndexFloatParamId::LayerRecordLevel:
-                        kernel.SetRecordLevel(indexFloatParamChangeRequest.value.value,
-                                              (int) indexFloatParamChangeRequest.value.index);
-                        break;
-                    case IndexFloatParamId::LayerPlaybackLevel:
-                        kernel.SetPlaybackLevel(indexFloatParamChangeRequest.value.value,
-                                                (int) indexFloatParamChangeRequest.value.index);
-                        break;
-                    case IndexFloatParamId::LayerFadeTime:
-/// FIXME: need a more formal/ explicit way of specifying parameter range mappings
-                        tmpValue = indexFloatParamChangeRequest.value.value * 10.f;
-                        kernel.SetFadeTime(tmpValue,
-                                           (int) indexFloatParamChangeRequest.value.index);
-
-                    case IndexFloatParamId::LayerSwitchTime:
-/// FIXME: need a more formal/ explicit way of specifying parameter range mappings
-                        tmpValue = indexFloatParamChangeRequest.value.value * 10.f;
-                        kernel.SetSwitchTime(tmpValue,
-                                             (int) indexFloatParamChangeRequest.value.index);
-
-                        break;
-                    default:
-                        break;
-                }
+                ApplyBoolParam(boolParamChangeRequest.id, boolParamChangeRequest.value);
             }
 
             ParamChangeRequest<IndexIndexParamId, IndexIndexParamValue> indexIndexParamChangeRequest{};
             while (paramChangeQ.indexIndexQ.try_dequeue(indexIndexParamChangeRequest)) {
-                switch (indexIndexParamChangeRequest.id) {
-
-                    case IndexIndexParamId::LayerMode:
-                        kernel.SetLayerMode(indexIndexParamChangeRequest.value.index,
-                                            static_cast<LayerBehaviorModeId>(indexIndexParamChangeRequest.value.value));
-                        break;
-
-                    case IndexIndexParamId::LayerLoopStartFrame:
-                        kernel.SetLoopStartFrame(indexIndexParamChangeRequest.value.value,
-                                                 (int) indexIndexParamChangeRequest.value.index);
-                        break;
-                    case IndexIndexParamId::LayerLoopEndFrame:
-                        kernel.SetLoopEndFrame(indexIndexParamChangeRequest.value.value,
-                                               (int) indexIndexParamChangeRequest.value.index);
-                        break;
-                    case IndexIndexParamId::LayerLoopResetFrame:
-                        kernel.SetLoopResetFrame(indexIndexParamChangeRequest.value.value,
-                                                 (int) indexIndexParamChangeRequest.value.index);
-                        break;
-                    default:
-                        break;
-                }
+                ApplyIndexIndexParam(indexIndexParamChangeRequest.id, indexIndexParamChangeRequest.value.index,
+                                     indexIndexParamChangeRequest.value.value);
             }
             ParamChangeRequest<IndexBoolParamId, IndexBoolParamValue> indexBoolParamChangeRequest{};
             while (paramChangeQ.indexBoolQ.try_dequeue(indexBoolParamChangeRequest)) {
-                switch (indexBoolParamChangeRequest.id) {
-                    case IndexBoolParamId::LayerWriteEnabled:
-                        kernel.SetLayerWrite(indexBoolParamChangeRequest.value.index,
-                                             indexBoolParamChangeRequest.value.value);
-                        break;
-                    case IndexBoolParamId::LayerClearEnabled:
-                        kernel.SetLayerClear(indexBoolParamChangeRequest.value.index,
-                                             indexBoolParamChangeRequest.value.value);
-                        break;
-                    case IndexBoolParamId::LayerReadEnabled:
-                        kernel.SetLayerRead(indexBoolParamChangeRequest.value.index,
-                                            indexBoolParamChangeRequest.value.value);
-                        break;
-                    case IndexBoolParamId::LayerLoopEnabled:
-                        kernel.SetLoopEnabled(
-                                /// FIXME: weird that the arguments are reversed on this one
-                                indexBoolParamChangeRequest.value.value,
-                                static_cast<int>(indexBoolParamChangeRequest.value.index));
-                        break;
-                    default:
-                        break;
+                ApplyIndexBoolParam(indexBoolParamChangeRequest.id, indexBoolParamChangeRequest.value.index,
+                                    indexBoolParamChangeRequest.value.value);
+            }
+
+            LayerRouteValue layerRoute{};
+            while (paramChangeQ.layerRouteQ.try_dequeue(layerRoute)) {
+                ApplyLayerRoute(layerRoute.index, layerRoute.condition, layerRoute.action, layerRoute.targets);
+            }
+
+            /// only the most recent program is loaded; older ones are retired unused
+            BehaviorProgram *behavior{nullptr};
+            BehaviorProgram *nextBehavior{nullptr};
+            while (paramChangeQ.behaviorQ.try_dequeue(nextBehavior)) {
+                if (behavior != nullptr) {
+                    // (never full; see `maxLiveBehaviors`)
+                    paramChangeQ.retiredBehaviorQ.try_enqueue(behavior);
                 }
+                behavior = nextBehavior;
+            }
+            if (behavior != nullptr) {
+                kernel.LoadBehavior(*behavior);
+                paramChangeQ.retiredBehaviorQ.try_enqueue(behavior);
+            }
+
+            LayerCountValue layerCount{};
+            while (paramChangeQ.layerCountQ.try_dequeue(layerCount)) {
+                ApplyLayerCount(layerCount.index, layerCount.condition, layerCount.action, layerCount.count);
             }
         }
 
@@ -405,8 +427,155 @@ namespace mlp {
             paramChangeQ.tapQ.enqueue(tapId);
         }
 
+        // apply a tap at once, rather than at the start of the next block.
+        // call from the audio thread only, between calls to `ProcessAudioBlock()`
+        void ApplyTap(TapId tapId) {
+            switch (tapId) {
+                case TapId::Set:
+                    kernel.SetLoopTap();
+                    break;
+                case TapId::Stop:
+                    kernel.StopLoop();
+                    break;
+                case TapId::Reset:
+                    kernel.ResetLayer();
+                    break;
+                case TapId::RetroClose:
+                    kernel.RetroCloseLoopTap();
+                    break;
+                case TapId::MeasureLatency:
+                    kernel.StartLatencyMeasurement();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // the changes that `IndexParamChange()` and the rest below queue, applied at once, as for `ApplyTap()`.
+        // call from the audio thread only, between calls to `ProcessAudioBlock()`
+        void ApplyIndexParam(IndexParamId id, unsigned long int value) {
+            switch (id) {
+                case IndexParamId::Mode:
+                    kernel.SetMode(static_cast<LayerBehaviorModeId>(value));
+                    break;
+                case IndexParamId::SelectLayer:
+                    kernel.SetCurrentLayer((unsigned int) value);
+                    break;
+                case IndexParamId::ResetLayer:
+                    kernel.ResetLayer((int) value);
+                    break;
+                case IndexParamId::RestartLayer:
+                    kernel.RestartLayer((int) value);
+                    break;
+                case IndexParamId::LoopStartFrame:
+                    kernel.SetLoopStartFrame(value);
+                    break;
+                case IndexParamId::LoopEndFrame:
+                    kernel.SetLoopEndFrame(value);
+                    break;
+                case IndexParamId::LoopResetFrame:
+                    kernel.SetLoopResetFrame(value);
+                    break;
+                case IndexParamId::SmoothMode:
+                    if (value < static_cast<unsigned long int>(SmoothParamMode::COUNT)) {
+                        kernel.SetLevelSmoothMode(static_cast<SmoothParamMode>(value));
+                    }
+                    break;
+                case IndexParamId::RetroPreRollFrames:
+                    kernel.SetRetroPreRoll(value);
+                    break;
+                case IndexParamId::CaptureLoopFrames:
+                    kernel.CaptureLoop(value);
+                    break;
+                case IndexParamId::InputLatencyFrames:
+                    kernel.SetInputLatency(value);
+                    break;
+                case IndexParamId::OutputLatencyFrames:
+                    kernel.SetOutputLatency(value);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void ApplyBoolParam(BoolParamId id, bool value) {
+            switch (id) {
+                case BoolParamId::WriteEnabled:
+                    kernel.SetWrite(value);
+                    break;
+                case BoolParamId::ClearEnabled:
+                    kernel.SetClear(value);
+                    break;
+                case BoolParamId::ReadEnabled:
+                    kernel.SetRead(value);
+                    break;
+                case BoolParamId::LoopEnabled:
+                    kernel.SetLoopEnabled(value);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void ApplyIndexIndexParam(IndexIndexParamId id, unsigned int index, unsigned long int value) {
+            switch (id) {
+                case IndexIndexParamId::LayerMode:
+                    kernel.SetLayerMode(index, static_cast<LayerBehaviorModeId>(value));
+                    break;
+                case IndexIndexParamId::LayerLoopStartFrame:
+                    kernel.SetLoopStartFrame(value, (int) index);
+                    break;
+                case IndexIndexParamId::LayerLoopEndFrame:
+                    kernel.SetLoopEndFrame(value, (int) index);
+                    break;
+                case IndexIndexParamId::LayerLoopResetFrame:
+                    kernel.SetLoopResetFrame(value, (int) index);
+                    break;
+                case IndexIndexParamId::LayerReadOffsetFrames:
+                    kernel.SetReadOffsetFrames(static_cast<float>(value), (int) index);
+                    break;
+                case IndexIndexParamId::LayerSmoothMode:
+                    if (value < static_cast<unsigned long int>(SmoothParamMode::COUNT)) {
+                        kernel.SetLevelSmoothMode(static_cast<SmoothParamMode>(value), (int) index);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void ApplyIndexBoolParam(IndexBoolParamId id, unsigned int index, bool value) {
+            switch (id) {
+                case IndexBoolParamId::LayerWriteEnabled:
+                    kernel.SetLayerWrite(index, value);
+                    break;
+                case IndexBoolParamId::LayerClearEnabled:
+                    kernel.SetLayerClear(index, value);
+                    break;
+                case IndexBoolParamId::LayerReadEnabled:
+                    kernel.SetLayerRead(index, value);
+                    break;
+                case IndexBoolParamId::LayerLoopEnabled:
+                    kernel.SetLoopEnabled(
+                            /// FIXME: weird that the arguments are reversed on this one
+                            value,
+                            static_cast<int>(index));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void ApplyLayerRoute(unsigned int index, LayerConditionId condition, LayerActionId action, LayerMask targets) {
+            kernel.SetLayerActionTargets(index, condition, action, targets);
+        }
+
+        void ApplyLayerCount(unsigned int index, LayerConditionId condition, LayerActionId action, int count) {
+            kernel.SetLayerActionCount(index, condition, action, count);
+        }
+
         void FloatParamChange(FloatParamId id, float value) {
-            paramChangeQ.floatQ.enqueue({id, value});
+            floatParams.Write(static_cast<unsigned int>(id), value);
         }
 
         void IndexParamChange(IndexParamId id, unsigned long int value) {
@@ -418,7 +587,9 @@ namespace mlp {
         }
 
         void IndexFloatParamChange(IndexFloatParamId id, unsigned int index, float value) {
-            paramChangeQ.indexFloatQ.enqueue({id, {index, value}});
+            if (index < numLoopLayers) {
+                indexFloatParams.Write(static_cast<unsigned int>(id) * numLoopLayers + index, value);
+            }
         }
 
         void IndexIndexParamChange(IndexIndexParamId id, unsigned int index, unsigned long int value) {
@@ -429,10 +600,62 @@ namespace mlp {
             paramChangeQ.indexBoolQ.enqueue({id, {index, value}});
         }
 
+        void LayerRouteChange(unsigned int index, LayerConditionId condition, LayerActionId action,
+                              LayerMask targets) {
+            paramChangeQ.layerRouteQ.enqueue({index, condition, action, targets});
+        }
+
+        void LayerCountChange(unsigned int index, LayerConditionId condition, LayerActionId action, int count) {
+            paramChangeQ.layerCountQ.enqueue({index, condition, action, count});
+        }
+
+        // compile a behavior script (see BehaviorScript.hpp) and load it at the start of the next block.
+        // call from a control thread; on failure, returns false and describes the first error
+        bool LoadBehaviorScript(const std::string &text, std::string &error) {
+            BehaviorProgram *retired;
+            while (paramChangeQ.retiredBehaviorQ.try_dequeue(retired)) {
+                delete retired;
+                --numLiveBehaviors;
+            }
+            if (numLiveBehaviors >= maxLiveBehaviors) {
+                error = "too many behavior scripts waiting to load";
+                return false;
+            }
+            auto *program = new BehaviorProgram;
+            if (!BehaviorScript::Compile(text, *program, error)) {
+                delete program;
+                return false;
+            }
+            ++numLiveBehaviors;
+            paramChangeQ.behaviorQ.enqueue(program);
+            return true;
+        }
+
         frame_t GetLoopEndFrame(unsigned int aLayerIndex) {
             return kernel.GetLoopEndFrame(aLayerIndex);
         }
 
+        // pack idle layers in the background, to save memory on long loops (see LayerCompressor.hpp).
+        // call from a control thread
+        void SetIdleCompression(bool enabled) {
+            if (enabled) {
+                kernel.GetCompressor().Start();
+            } else {
+                kernel.GetCompressor().Stop();
+            }
+        }
+
+        // process layers in parallel on this many worker threads (besides the audio thread); zero is serial.
+        // output is the same either way. call from a control thread, preferably before processing starts
+        void SetLayerWorkers(unsigned int numWorkers, int firstCore = -1, int priority = 0) {
+            kernel.SetLayerWorkers(numWorkers, firstCore, priority);
+        }
+
+        // round trip found by the last TapId::MeasureLatency, in frames (zero until it succeeds)
+        frame_t GetMeasuredLatency() const {
+            return kernel.GetMeasuredLatency();
+        }
+
     };
 }
 
@@ -0,0 +1,463 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "../Mlp.hpp"
+#include "WavFile.hpp"
+
+//-----------------------------------------------------------------------------------
+// offline rendering of many (input, event script) pairs, spread over worker threads.
+//
+// the manifest has one job per line: `<input.wav> <events.txt> <output.wav>`,
+// with paths relative to the manifest's directory, and `#` comments.
+//
+// an event script has one event per line: `<time> <command> [arguments...]`,
+// where time is in seconds, or in frames with an `f` suffix (e.g. `44100f`).
+// commands follow the OSC interface:
+//   tap <id>
+//   fparam <id> <value>          ifparam <id> <layer> <value>
+//   iparam <id> <value>          iiparam <id> <layer> <value>
+//   bparam <id> <0|1>            ibparam <id> <layer> <0|1>
+//   route <layer> <condition> <action> <target mask>
+//   count <layer> <condition> <action> <count>
+//   behavior <script file>
+//   end                          (render until this time, padding the input with silence)
+// ids, conditions and actions may be given as numbers or labels (e.g. `tap SET`, `fparam PRESERVE 0.5`).
+//
+// each worker owns one Mlp at a time, which is replaced for every job,
+// so memory is bounded by the number of workers rather than the number of jobs;
+// and there are no more workers than there is physical memory for.
+namespace batch {
+
+    using namespace mlp;
+
+    static constexpr unsigned int blockFrames = 512;
+
+    struct Job {
+        std::string inputPath;
+        std::string scriptPath;
+        std::string outputPath;
+    };
+
+    struct Result {
+        bool isOk{false};
+        std::string error;
+        double audioSeconds{0.0};
+        double elapsedSeconds{0.0};
+    };
+
+    struct Event {
+        frame_t time;
+        std::function<void(Mlp &)> apply;
+    };
+
+    struct Script {
+        std::vector<Event> events;
+        // zero if the script has no `end`
+        frame_t endTime{0};
+    };
+
+    // parse a number or one of the given labels into an enum index
+    template<int numIds, int labelSize>
+    inline bool ParseId(const std::string &token, const char (&labels)[numIds][labelSize], int &id) {
+        for (int i = 0; i < numIds; ++i) {
+            if (token == labels[i]) {
+                id = i;
+                return true;
+            }
+        }
+        char *end;
+        const long int value = std::strtol(token.c_str(), &end, 10);
+        if (end == token.c_str() || *end != '\0' || value < 0 || value >= numIds) {
+            return false;
+        }
+        id = static_cast<int>(value);
+        return true;
+    }
+
+    inline bool ParseTime(const std::string &token, float sampleRate, frame_t &time) {
+        if (!token.empty() && token.back() == 'f') {
+            // digits only; `strtoull` would also take a sign, and wrap a negative count
+            if (token.size() < 2 || token.find_first_not_of("0123456789") != token.size() - 1) {
+                return false;
+            }
+            time = std::strtoull(token.c_str(), nullptr, 10);
+            return true;
+        }
+        char *end;
+        const double seconds = std::strtod(token.c_str(), &end);
+        if (end == token.c_str() || *end != '\0' || seconds < 0.0) {
+            return false;
+        }
+        time = static_cast<frame_t>(seconds * sampleRate + 0.5);
+        return true;
+    }
+
+    inline std::string ReadFile(const std::string &path, bool &isOk) {
+        std::ifstream in(path);
+        isOk = static_cast<bool>(in);
+        std::stringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+
+    // parse one event's command and arguments; returns false with a description on error
+    inline bool ParseCommand(std::istringstream &args, const std::string &command, const std::string &directory,
+                             Script &script, Event &event, std::string &error) {
+        int id, layer, condition, action;
+        std::string token;
+        float value;
+        long int index;
+        auto parseId = [&](auto &labels) {
+            return static_cast<bool>(args >> token) && ParseId(token, labels, id);
+        };
+        // the kernel's indexed setters only assert the layer, so check it here
+        auto parseLayer = [&]() {
+            if (!(args >> layer)) {
+                return false;
+            }
+            if (layer < 0 || layer >= numLoopLayers) {
+                error = "no such layer " + std::to_string(layer);
+                return false;
+            }
+            return true;
+        };
+        if (command == "tap") {
+            if (!parseId(Mlp::TapIdLabel)) return false;
+            event.apply = [id](Mlp &m) { m.Tap(static_cast<Mlp::TapId>(id)); };
+        } else if (command == "fparam") {
+            if (!parseId(Mlp::FloatParamIdLabel) || !(args >> value)) return false;
+            event.apply = [id, value](Mlp &m) { m.FloatParamChange(static_cast<Mlp::FloatParamId>(id), value); };
+        } else if (command == "iparam") {
+            if (!parseId(Mlp::IndexParamIdLabel) || !(args >> index) || index < 0) return false;
+            if (id == static_cast<int>(Mlp::IndexParamId::SelectLayer) && index >= numLoopLayers) {
+                error = "no such layer " + std::to_string(index);
+                return false;
+            }
+            event.apply = [id, index](Mlp &m) {
+                m.IndexParamChange(static_cast<Mlp::IndexParamId>(id), static_cast<unsigned long int>(index));
+            };
+        } else if (command == "bparam") {
+            if (!parseId(Mlp::BoolParamIdLabel) || !(args >> index)) return false;
+            event.apply = [id, index](Mlp &m) { m.BoolParamChange(static_cast<Mlp::BoolParamId>(id), index != 0); };
+        } else if (command == "ifparam") {
+            if (!parseId(Mlp::IndexFloatParamIdLabel) || !parseLayer() || !(args >> value)) return false;
+            event.apply = [id, layer, value](Mlp &m) {
+                m.IndexFloatParamChange(static_cast<Mlp::IndexFloatParamId>(id), static_cast<unsigned int>(layer),
+                                        value);
+            };
+        } else if (command == "iiparam") {
+            if (!parseId(Mlp::IndexIndexParamIdLabel) || !parseLayer() || !(args >> index) || index < 0) {
+                return false;
+            }
+            event.apply = [id, layer, index](Mlp &m) {
+                m.IndexIndexParamChange(static_cast<Mlp::IndexIndexParamId>(id), static_cast<unsigned int>(layer),
+                                        static_cast<unsigned long int>(index));
+            };
+        } else if (command == "ibparam") {
+            if (!parseId(Mlp::IndexBoolParamIdLabel) || !parseLayer() || !(args >> index)) return false;
+            event.apply = [id, layer, index](Mlp &m) {
+                m.IndexBoolParamChange(static_cast<Mlp::IndexBoolParamId>(id), static_cast<unsigned int>(layer),
+                                       index != 0);
+            };
+        } else if (command == "route" || command == "count") {
+            if (!parseLayer() || !(args >> token) || !ParseId(token, LayerConditionIdLabel, condition)
+                || !(args >> token) || !ParseId(token, LayerActionIdLabel, action) || !(args >> index)) {
+                return false;
+            }
+            const bool isRoute = command == "route";
+            event.apply = [isRoute, layer, condition, action, index](Mlp &m) {
+                if (isRoute) {
+                    m.LayerRouteChange(static_cast<unsigned int>(layer), static_cast<LayerConditionId>(condition),
+                                       static_cast<LayerActionId>(action), static_cast<LayerMask>(index));
+                } else {
+                    m.LayerCountChange(static_cast<unsigned int>(layer), static_cast<LayerConditionId>(condition),
+                                       static_cast<LayerActionId>(action), static_cast<int>(index));
+                }
+            };
+        } else if (command == "behavior") {
+            if (!(args >> token)) return false;
+            bool isOk;
+            const std::string text = ReadFile(token[0] == '/' ? token : directory + token, isOk);
+            if (!isOk) {
+                error = "can't read behavior script " + token;
+                return false;
+            }
+            event.apply = [text](Mlp &m) {
+                std::string behaviorError;
+                if (!m.LoadBehaviorScript(text, behaviorError)) {
+                    std::cerr << "[batch] behavior script error: " << behaviorError << std::endl;
+                }
+            };
+        } else if (command == "end") {
+            script.endTime = event.time;
+        } else {
+            error = "unknown command " + command;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool ParseScript(const std::string &path, float sampleRate, Script &script, std::string &error) {
+        bool isOk;
+        std::istringstream text(ReadFile(path, isOk));
+        if (!isOk) {
+            error = "can't read event script " + path;
+            return false;
+        }
+        const auto slash = path.find_last_of('/');
+        const std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(text, line)) {
+            lineNumber++;
+            const auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.resize(comment);
+            }
+            std::istringstream args(line);
+            std::string time, command;
+            if (!(args >> time)) {
+                continue;
+            }
+            Event event{};
+            if (!ParseTime(time, sampleRate, event.time)) {
+                error = "bad time " + time;
+            } else if (!(args >> command)) {
+                error = "missing command";
+            } else if (!ParseCommand(args, command, directory, script, event, error) && error.empty()) {
+                error = "bad arguments for " + command;
+            }
+            if (!error.empty()) {
+                error = path + ":" + std::to_string(lineNumber) + ": " + error;
+                return false;
+            }
+            if (event.apply) {
+                script.events.push_back(std::move(event));
+            }
+        }
+        // events at the same time keep their order
+        std::stable_sort(script.events.begin(), script.events.end(),
+                         [](const Event &a, const Event &b) { return a.time < b.time; });
+        return true;
+    }
+
+    // render one job, streaming from the input to the output file.
+    // blocks are split at event times, so every event lands on its frame.
+    // if the output can't be written in full, it is removed
+    inline void Render(Mlp &m, const Job &job, Result &result) {
+        const auto startTime = std::chrono::steady_clock::now();
+        WavReader reader;
+        WavWriter writer;
+        Script script;
+        if (!reader.Open(job.inputPath.c_str(), result.error)
+            || !ParseScript(job.scriptPath, static_cast<float>(reader.sampleRate), script, result.error)) {
+            return;
+        }
+        auto fail = [&](const std::string &error) {
+            writer.Abandon();
+            result.error = error;
+        };
+        if (!writer.Open(job.outputPath.c_str(), reader.sampleRate, result.error)) {
+            writer.Abandon();
+            return;
+        }
+        m.SetSampleRate(static_cast<float>(reader.sampleRate));
+
+        const frame_t numFrames = std::max<frame_t>(reader.numFrames, script.endTime);
+        std::vector<float> in(blockFrames * 2), out(blockFrames * 2);
+        std::vector<AudioSample> src(blockFrames * 2), dst(blockFrames * 2);
+        size_t nextEvent = 0;
+        frame_t time = 0;
+        while (time < numFrames) {
+            while (nextEvent < script.events.size() && script.events[nextEvent].time <= time) {
+                script.events[nextEvent++].apply(m);
+            }
+            frame_t n = std::min<frame_t>(blockFrames, numFrames - time);
+            if (nextEvent < script.events.size()) {
+                n = std::min<frame_t>(n, script.events[nextEvent].time - time);
+            }
+            const auto frames = static_cast<unsigned int>(n);
+            const unsigned int got = reader.Read(in.data(), frames);
+            std::fill(in.begin() + got * 2, in.begin() + frames * 2, 0.f);
+            for (unsigned int i = 0; i < frames * 2; ++i) {
+                src[i] = FromFloat<AudioSample>(in[i]);
+            }
+            m.ProcessAudioBlock(src.data(), dst.data(), frames);
+            for (unsigned int i = 0; i < frames * 2; ++i) {
+                out[i] = ToFloat(dst[i]);
+            }
+            if (!writer.Write(out.data(), frames)) {
+                fail("can't write to " + job.outputPath);
+                return;
+            }
+            // nobody is listening to the outputs; don't let them pile up
+            LayerFlagsMessageData flags;
+            while (m.GetLayerFlagsQ().try_dequeue(flags)) {}
+            LayerPositionMessageData position;
+            while (m.GetLayerPositionQ().try_dequeue(position)) {}
+            time += n;
+        }
+        if (!writer.Close()) {
+            fail("can't finish writing " + job.outputPath);
+            return;
+        }
+
+        result.audioSeconds = static_cast<double>(numFrames) / reader.sampleRate;
+        result.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        result.isOk = true;
+    }
+
+    inline bool ParseManifest(const char *path, std::vector<Job> &jobs, std::string &error) {
+        bool isOk;
+        std::istringstream text(ReadFile(path, isOk));
+        if (!isOk) {
+            error = std::string("can't read manifest ") + path;
+            return false;
+        }
+        const std::string manifestPath(path);
+        const auto slash = manifestPath.find_last_of('/');
+        const std::string directory = slash == std::string::npos ? "" : manifestPath.substr(0, slash + 1);
+        auto resolve = [&](const std::string &p) { return p[0] == '/' ? p : directory + p; };
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(text, line)) {
+            lineNumber++;
+            const auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.resize(comment);
+            }
+            std::istringstream fields(line);
+            Job job;
+            if (!(fields >> job.inputPath)) {
+                continue;
+            }
+            if (!(fields >> job.scriptPath >> job.outputPath)) {
+                error = manifestPath + ":" + std::to_string(lineNumber) + ": expected <input> <events> <output>";
+                return false;
+            }
+            job.inputPath = resolve(job.inputPath);
+            job.scriptPath = resolve(job.scriptPath);
+            job.outputPath = resolve(job.outputPath);
+            jobs.push_back(job);
+        }
+        return true;
+    }
+
+    // physical memory free for new instances (counting reclaimable cache where the OS says), or zero if unknown
+    inline size_t AvailableMemory() {
+#if defined(__linux__)
+        std::ifstream meminfo("/proc/meminfo");
+        std::string line;
+        while (std::getline(meminfo, line)) {
+            std::istringstream fields(line);
+            std::string key;
+            size_t kilobytes;
+            if (fields >> key >> kilobytes && key == "MemAvailable:") {
+                return kilobytes * 1024;
+            }
+        }
+        return 0;
+#elif defined(__APPLE__)
+        // no cheap figure for free memory here; take half of it all
+        return static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 2;
+#elif defined(_WIN32)
+        MEMORYSTATUSEX status{};
+        status.dwLength = sizeof(status);
+        return GlobalMemoryStatusEx(&status) ? static_cast<size_t>(status.ullAvailPhys) : 0;
+#else
+        return 0;
+#endif
+    }
+
+    // render every job in the manifest on the given number of workers (zero for one per core).
+    // returns the number of failed jobs
+    inline int Run(const char *manifestPath, unsigned int numWorkers) {
+        std::vector<Job> jobs;
+        std::string error;
+        if (!ParseManifest(manifestPath, jobs, error)) {
+            std::cerr << "[batch] " << error << std::endl;
+            return 1;
+        }
+        if (jobs.empty()) {
+            std::cout << "[batch] nothing to render" << std::endl;
+            return 0;
+        }
+        if (numWorkers == 0) {
+            numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        numWorkers = std::min<unsigned int>(numWorkers, static_cast<unsigned int>(jobs.size()));
+        // an instance is nearly all loop buffers, which are filled on construction, so all of it is resident
+        const size_t availableMemory = AvailableMemory();
+        if (availableMemory > 0 && numWorkers * sizeof(Mlp) > availableMemory) {
+            numWorkers = std::max<unsigned int>(1, static_cast<unsigned int>(availableMemory / sizeof(Mlp)));
+            std::cout << "[batch] memory for " << numWorkers << " workers of " << sizeof(Mlp) / (1 << 20)
+                      << " MB each" << std::endl;
+        }
+        std::cout << "[batch] rendering " << jobs.size() << " jobs on " << numWorkers << " workers" << std::endl;
+
+        std::vector<Result> results(jobs.size());
+        std::atomic<size_t> nextJob{0};
+        const auto startTime = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w) {
+            workers.emplace_back([&] {
+                std::unique_ptr<Mlp> m;
+                for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+                    // free the last job's instance before making the next one
+                    m.reset();
+                    m = std::make_unique<Mlp>();
+                    Render(*m, jobs[i], results[i]);
+                }
+            });
+        }
+        for (auto &w: workers) {
+            w.join();
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        int numFailed = 0;
+        double audioSeconds = 0.0;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            const auto &r = results[i];
+            if (!r.isOk) {
+                numFailed++;
+                std::cerr << "[batch] failed: " << jobs[i].outputPath << ": " << r.error << std::endl;
+                continue;
+            }
+            audioSeconds += r.audioSeconds;
+            std::cout << "[batch] " << jobs[i].outputPath << ": " << r.audioSeconds << " s in "
+                      << r.elapsedSeconds << " s (" << r.audioSeconds / r.elapsedSeconds << "x realtime)"
+                      << std::endl;
+        }
+        const double speed = elapsed > 0.0 ? audioSeconds / elapsed : 0.0;
+        std::cout << "[batch] rendered " << jobs.size() - numFailed << " of " << jobs.size() << " jobs: "
+                  << audioSeconds << " s of audio in " << elapsed << " s; "
+                  << speed << "x realtime, " << speed / numWorkers << "x per core" << std::endl;
+        return numFailed;
+    }
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "readerwriterqueue/readerwriterqueue.h"
+
+#include "../Mlp.hpp"
+#include "OscDispatch.hpp"
+
+//-----------------------------------------------------------------------------------
+// commands for one looper, applied on the audio thread at the frame they are due.
+//
+// the receive thread pushes parsed commands with the wall-clock time they are due (zero for "now");
+// each block, the audio thread takes them in time order, and splits the block at their frames,
+// so a timed bundle lands on the sample it names rather than on the next block boundary.
+// times map to frames as the block is processed; device latency is not compensated.
+//
+// commands go straight to the looper (see `Mlp::ApplyTap()` and the rest), rather than through its
+// parameter queues, which can allocate when they grow.
+class CommandSchedule {
+public:
+    static constexpr unsigned int queueSize = 1024;
+    // commands held back for later blocks; any more are applied early
+    static constexpr unsigned int maxPending = 256;
+
+    CommandSchedule() : queue(queueSize) {}
+
+    // convert an OSC timetag (NTP: seconds since 1900 in the upper 32 bits, fraction in the lower)
+    // to nanoseconds of the system clock; the special timetag 1 means "now", i.e. zero
+    static int64_t TimeTagToNanos(uint64_t timeTag) {
+        if (timeTag <= 1) {
+            return 0;
+        }
+        constexpr int64_t unixEpoch = 2208988800; // 1970 - 1900, in seconds
+        const auto seconds = static_cast<int64_t>(timeTag >> 32) - unixEpoch;
+        const auto nanos = static_cast<int64_t>(((timeTag & 0xffffffffu) * 1000000000u) >> 32);
+        return seconds * 1000000000 + nanos;
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // call from the receive thread; returns false if the queue is full
+    bool Push(const dispatch::Command &command, int64_t time) {
+        return queue.try_enqueue({command, time});
+    }
+
+    // call from the audio thread in place of `Mlp::ProcessAudioBlock()`
+    void Process(mlp::Mlp &m, const mlp::AudioSample *input, mlp::AudioSample *output, unsigned int numFrames,
+                 float sampleRate) {
+        Entry entry;
+        while (queue.try_dequeue(entry)) {
+            if (numPending == maxPending) {
+                dispatch::Apply(m, entry.command);
+                continue;
+            }
+            // insert in time order, after any due at the same time
+            unsigned int i = numPending++;
+            while (i > 0 && pending[i - 1].time > entry.time) {
+                pending[i] = pending[i - 1];
+                --i;
+            }
+            pending[i] = entry;
+        }
+        if (numPending == 0) {
+            m.ProcessAudioBlock(input, output, numFrames);
+            return;
+        }
+
+        const int64_t now = Now();
+        const double framesPerNano = static_cast<double>(sampleRate) * 1e-9;
+        // the frame in this block at which an entry is due; `numFrames` if it is due later
+        auto dueFrame = [&](const Entry &e) {
+            if (e.time <= now) {
+                return 0u;
+            }
+            const double frames = static_cast<double>(e.time - now) * framesPerNano;
+            return frames < numFrames ? static_cast<unsigned int>(frames) : numFrames;
+        };
+
+        unsigned int numApplied = 0;
+        unsigned int frame = 0;
+        while (frame < numFrames) {
+            unsigned int end = numFrames;
+            while (numApplied < numPending) {
+                end = dueFrame(pending[numApplied]);
+                if (end > frame) {
+                    break;
+                }
+                dispatch::Apply(m, pending[numApplied++].command);
+                end = numFrames;
+            }
+            m.ProcessAudioBlock(input + frame * mlp::numLoopChannels, output + frame * mlp::numLoopChannels,
+                                end - frame);
+            frame = end;
+        }
+        for (unsigned int i = numApplied; i < numPending; ++i) {
+            pending[i - numApplied] = pending[i];
+        }
+        numPending -= numApplied;
+    }
+
+private:
+    struct Entry {
+        dispatch::Command command;
+        int64_t time;
+    };
+
+    moodycamel::ReaderWriterQueue<Entry> queue;
+    Entry pending[maxPending];
+    unsigned int numPending{0};
+};
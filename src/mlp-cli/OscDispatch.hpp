@@ -0,0 +1,366 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/// oscpack
+#include "osc/OscReceivedElements.h"
+
+#include "../Mlp.hpp"
+
+//-----------------------------------------------------------------------------------
+// OSC address dispatch for the looper API.
+//
+// addresses map to handlers through a hash table that is built, and checked for collisions, at compile time;
+// a lookup hashes the incoming address once and confirms the match with a single string comparison.
+// messages are parsed into commands straight from the received packet, without allocating,
+// and commands can be applied later (see CommandSchedule.hpp); `/behavior` compiles its script as it's applied.
+//
+//   /tap <id>
+//   /fparam <id> <value>          /ifparam <id> <layer> <value>
+//   /iparam <id> <value>          /iiparam <id> <layer> <value>
+//   /bparam <id> <bool>           /ibparam <id> <layer> <bool>
+//   /select <layer>
+//   /route <layer> <condition> <action> <target mask>
+//   /count <layer> <condition> <action> <count>       (negative count is unlimited)
+//   /behavior <script text>
+// (addresses may also name instances and layers, with patterns; see OscPattern.hpp)
+//
+// ids, conditions and actions may be int32 indices or label strings (e.g. "SET", "PRESERVE").
+// numbers may be sent as int32, float or double, and bools also as T/F,
+// since many controllers can only send one type.
+namespace dispatch {
+
+    using namespace mlp;
+
+    // sequential reader over one message's arguments; throws `osc::Exception` on a missing or mistyped argument
+    class Args {
+        osc::ReceivedMessageArgumentIterator arg;
+        osc::ReceivedMessageArgumentIterator end;
+        // layers given by the address (e.g. `/layer/2/ifparam`) rather than an argument
+        bool isLayerInAddress;
+        bool didTakeLayer{false};
+
+        const osc::ReceivedMessageArgument &Next() {
+            if (arg == end) {
+                throw osc::MissingArgumentException();
+            }
+            return *arg++;
+        }
+
+    public:
+        Args(const osc::ReceivedMessage &msg, bool isLayerInAddress) :
+                arg(msg.ArgumentsBegin()), end(msg.ArgumentsEnd()), isLayerInAddress(isLayerInAddress) {}
+
+        bool DidTakeLayer() const {
+            return didTakeLayer;
+        }
+
+        float Float() {
+            const auto &a = Next();
+            if (a.IsFloat()) return a.AsFloatUnchecked();
+            if (a.IsInt32()) return static_cast<float>(a.AsInt32Unchecked());
+            if (a.IsDouble()) return static_cast<float>(a.AsDoubleUnchecked());
+            throw osc::WrongArgumentTypeException();
+        }
+
+        long int Int() {
+            const auto &a = Next();
+            if (a.IsInt32()) return a.AsInt32Unchecked();
+            if (a.IsFloat()) return std::lround(a.AsFloatUnchecked());
+            if (a.IsDouble()) return std::lround(a.AsDoubleUnchecked());
+            throw osc::WrongArgumentTypeException();
+        }
+
+        unsigned long int Unsigned() {
+            const long int x = Int();
+            if (x < 0) {
+                throw osc::Exception("negative value");
+            }
+            return static_cast<unsigned long int>(x);
+        }
+
+        bool Bool() {
+            const auto &a = Next();
+            if (a.IsBool()) return a.AsBoolUnchecked();
+            if (a.IsInt32()) return a.AsInt32Unchecked() != 0;
+            if (a.IsFloat()) return a.AsFloatUnchecked() != 0.f;
+            throw osc::WrongArgumentTypeException();
+        }
+
+        const char *String() {
+            const auto &a = Next();
+            if (a.IsString()) return a.AsStringUnchecked();
+            throw osc::WrongArgumentTypeException();
+        }
+
+        // an index into the given label array, sent as the index or the label
+        template<int numIds, int labelSize>
+        int Label(const char (&labels)[numIds][labelSize]) {
+            const auto &a = Next();
+            if (a.IsString()) {
+                const char *s = a.AsStringUnchecked();
+                for (int i = 0; i < numIds; ++i) {
+                    if (std::strcmp(s, labels[i]) == 0) {
+                        return i;
+                    }
+                }
+                throw osc::Exception("unknown label");
+            }
+            long int i;
+            if (a.IsInt32()) {
+                i = a.AsInt32Unchecked();
+            } else if (a.IsFloat()) {
+                i = std::lround(a.AsFloatUnchecked());
+            } else {
+                throw osc::WrongArgumentTypeException();
+            }
+            if (i < 0 || i >= numIds) {
+                throw osc::Exception("index out of range");
+            }
+            return static_cast<int>(i);
+        }
+
+        // (a placeholder if the address gives the layers; see `Command::layers`)
+        unsigned int Layer() {
+            didTakeLayer = true;
+            if (isLayerInAddress) {
+                return 0;
+            }
+            const unsigned long int layer = Unsigned();
+            if (layer >= static_cast<unsigned long int>(numLoopLayers)) {
+                throw osc::Exception("no such layer");
+            }
+            return static_cast<unsigned int>(layer);
+        }
+    };
+
+    // one parsed message, which can be applied later and on the audio thread (see CommandSchedule.hpp),
+    // where commands take effect at once and allocate nothing.
+    // (except for `text`, which points into the received packet; see `isDeferrable`)
+    struct Command {
+        void (*apply)(Mlp &m, const Command &command){nullptr};
+        // false if the command must be applied while its packet is still around
+        bool isDeferrable{true};
+        int id{0};
+        unsigned int layer{0};
+        // layers named by the address, to apply the command to each in turn; zero to use `layer`
+        LayerMask layers{0};
+        int condition{0};
+        int action{0};
+        float number{0.f};
+        long int integer{0};
+        bool flag{false};
+        const char *text{nullptr};
+    };
+
+    struct Route {
+        const char *address;
+        void (*parse)(Args &args, Command &command);
+        void (*apply)(Mlp &m, const Command &command);
+    };
+
+    static constexpr Route routes[] = {
+            {"/tap",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::TapIdLabel);
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyTap(static_cast<Mlp::TapId>(c.id));
+             }},
+            {"/fparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::FloatParamIdLabel);
+                 c.number = args.Float();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.FloatParamChange(static_cast<Mlp::FloatParamId>(c.id), c.number);
+             }},
+            {"/iparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::IndexParamIdLabel);
+                 c.integer = static_cast<long int>(args.Unsigned());
+                 if (c.id == static_cast<int>(Mlp::IndexParamId::SelectLayer) && c.integer >= numLoopLayers) {
+                     throw osc::Exception("no such layer");
+                 }
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyIndexParam(static_cast<Mlp::IndexParamId>(c.id), static_cast<unsigned long int>(c.integer));
+             }},
+            {"/bparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::BoolParamIdLabel);
+                 c.flag = args.Bool();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyBoolParam(static_cast<Mlp::BoolParamId>(c.id), c.flag);
+             }},
+            {"/ifparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::IndexFloatParamIdLabel);
+                 c.layer = args.Layer();
+                 c.number = args.Float();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.IndexFloatParamChange(static_cast<Mlp::IndexFloatParamId>(c.id), c.layer, c.number);
+             }},
+            {"/iiparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::IndexIndexParamIdLabel);
+                 c.layer = args.Layer();
+                 c.integer = static_cast<long int>(args.Unsigned());
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyIndexIndexParam(static_cast<Mlp::IndexIndexParamId>(c.id), c.layer,
+                                        static_cast<unsigned long int>(c.integer));
+             }},
+            {"/ibparam",
+             [](Args &args, Command &c) {
+                 c.id = args.Label(Mlp::IndexBoolParamIdLabel);
+                 c.layer = args.Layer();
+                 c.flag = args.Bool();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyIndexBoolParam(static_cast<Mlp::IndexBoolParamId>(c.id), c.layer, c.flag);
+             }},
+            {"/select",
+             [](Args &args, Command &c) {
+                 c.layer = args.Layer();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyIndexParam(Mlp::IndexParamId::SelectLayer, c.layer);
+             }},
+            {"/route",
+             [](Args &args, Command &c) {
+                 c.layer = args.Layer();
+                 c.condition = args.Label(LayerConditionIdLabel);
+                 c.action = args.Label(LayerActionIdLabel);
+                 c.integer = static_cast<long int>(args.Unsigned());
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyLayerRoute(c.layer, static_cast<LayerConditionId>(c.condition),
+                                   static_cast<LayerActionId>(c.action), static_cast<LayerMask>(c.integer));
+             }},
+            {"/count",
+             [](Args &args, Command &c) {
+                 c.layer = args.Layer();
+                 c.condition = args.Label(LayerConditionIdLabel);
+                 c.action = args.Label(LayerActionIdLabel);
+                 c.integer = args.Int();
+             },
+             [](Mlp &m, const Command &c) {
+                 m.ApplyLayerCount(c.layer, static_cast<LayerConditionId>(c.condition),
+                                   static_cast<LayerActionId>(c.action), static_cast<int>(c.integer));
+             }},
+            {"/behavior",
+             [](Args &args, Command &c) {
+                 c.text = args.String();
+                 c.isDeferrable = false;
+             },
+             [](Mlp &m, const Command &c) {
+                 std::string error;
+                 if (!m.LoadBehaviorScript(c.text, error)) {
+                     std::cerr << "behavior script error: " << error << std::endl;
+                 }
+             }},
+    };
+
+    static constexpr unsigned int numRoutes = sizeof(routes) / sizeof(routes[0]);
+
+    //------------------------------------------------
+    // the hash table: FNV-1a, with the first seed (offset basis) that puts every address in its own slot
+
+    static constexpr unsigned int tableBits = 5;
+    static constexpr unsigned int tableSize = 1u << tableBits;
+    static_assert(numRoutes <= tableSize, "too many addresses for the dispatch table");
+
+    constexpr uint32_t Hash(const char *s, uint32_t seed) {
+        uint32_t h = seed;
+        while (*s != '\0') {
+            h = (h ^ static_cast<unsigned char>(*s++)) * 16777619u;
+        }
+        return h;
+    }
+
+    constexpr unsigned int Slot(uint32_t hash) {
+        // the top bits mix best
+        return hash >> (32 - tableBits);
+    }
+
+    constexpr bool IsPerfect(uint32_t seed) {
+        for (unsigned int i = 0; i < numRoutes; ++i) {
+            for (unsigned int j = i + 1; j < numRoutes; ++j) {
+                if (Slot(Hash(routes[i].address, seed)) == Slot(Hash(routes[j].address, seed))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    constexpr uint32_t FindSeed() {
+        uint32_t seed = 2166136261u;
+        for (int tries = 0; tries < 10000 && !IsPerfect(seed); ++tries) {
+            ++seed;
+        }
+        return seed;
+    }
+
+    static constexpr uint32_t seed = FindSeed();
+    static_assert(IsPerfect(seed), "no collision-free seed for the dispatch table; increase tableBits");
+
+    struct Table {
+        // route index + 1 per slot, zero if empty
+        unsigned char slots[tableSize]{};
+    };
+
+    constexpr Table MakeTable() {
+        Table table{};
+        for (unsigned int i = 0; i < numRoutes; ++i) {
+            table.slots[Slot(Hash(routes[i].address, seed))] = static_cast<unsigned char>(i + 1);
+        }
+        return table;
+    }
+
+    static constexpr Table table = MakeTable();
+
+    // the route for an address, or null if there is none
+    inline const Route *Find(const char *address) {
+        const unsigned int entry = table.slots[Slot(Hash(address, seed))];
+        if (entry == 0 || std::strcmp(address, routes[entry - 1].address) != 0) {
+            return nullptr;
+        }
+        return &routes[entry - 1];
+    }
+
+    // parse a message for the given route into a command; throws `osc::Exception` on bad arguments.
+    // with a non-zero `layers`, the layers come from the address instead of the arguments
+    inline void Parse(const Route &route, const osc::ReceivedMessage &msg, LayerMask layers, Command &command) {
+        Args args(msg, layers != 0);
+        command = Command();
+        command.apply = route.apply;
+        command.layers = layers;
+        route.parse(args, command);
+        if (layers != 0 && !args.DidTakeLayer()) {
+            throw osc::Exception("address has a layer, but the command takes none");
+        }
+    }
+
+    inline void Apply(Mlp &m, const Command &command) {
+        if (command.layers == 0) {
+            command.apply(m, command);
+            return;
+        }
+        Command layerCommand = command;
+        for (unsigned int i = 0; i < numLoopLayers; ++i) {
+            if ((command.layers & (1u << i)) != 0) {
+                layerCommand.layer = i;
+                command.apply(m, layerCommand);
+            }
+        }
+    }
+
+}
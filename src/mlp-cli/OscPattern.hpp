@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "OscDispatch.hpp"
+
+//-----------------------------------------------------------------------------------
+// resolution of OSC addresses, including OSC 1.0 patterns, to the commands and loopers they name.
+//
+// the full address is `[/mlp/<instance>][/layer/<layer>]/<command>`, e.g. `/mlp/1/layer/2/ifparam`;
+// without an instance, the first is meant, and with a layer, the command takes no layer argument.
+// the instance, layer and command segments may be patterns (`*`, `?`, `[a-z]`, `[!0-3]`, `{a,b}`),
+// e.g. `/layer/*/ifparam PRESERVE 0.5` sets every layer, and `/mlp/{0,2}/tap SET` taps two instances.
+//
+// plain addresses are parsed directly. a pattern is matched against every instance, layer and command
+// the first time it arrives, and the result is cached, so a controller repeating one pattern pays for
+// one hash lookup per message
+namespace dispatch {
+
+    // instances are addressed by a 64-bit mask
+    static constexpr unsigned int maxInstances = 64;
+
+    struct Targets {
+        uint64_t instances{0};
+        // layers named by the address, or zero if it names none
+        LayerMask layers{0};
+        // bit i for `routes[i]`
+        uint32_t routes{0};
+    };
+    static_assert(numRoutes <= 32, "routes must fit in the target mask");
+
+    // match one address segment [pattern, patternEnd) against a whole (null-terminated) name
+    inline bool MatchSegment(const char *pattern, const char *patternEnd, const char *name) {
+        const char *p = pattern;
+        const char *s = name;
+        while (p < patternEnd) {
+            switch (*p) {
+                case '*':
+                    // try the rest of the pattern at every point, shortest match first
+                    ++p;
+                    do {
+                        if (MatchSegment(p, patternEnd, s)) {
+                            return true;
+                        }
+                    } while (*s++ != '\0');
+                    return false;
+                case '?':
+                    if (*s == '\0') {
+                        return false;
+                    }
+                    ++p;
+                    ++s;
+                    break;
+                case '[': {
+                    const char *close = static_cast<const char *>(std::memchr(p, ']', patternEnd - p));
+                    if (close == nullptr || *s == '\0') {
+                        return false;
+                    }
+                    const bool isNegated = p[1] == '!';
+                    bool isInSet = false;
+                    for (const char *q = p + 1 + isNegated; q < close; ++q) {
+                        if (q + 2 < close && q[1] == '-') {
+                            isInSet |= *s >= q[0] && *s <= q[2];
+                            q += 2;
+                        } else {
+                            isInSet |= *s == *q;
+                        }
+                    }
+                    if (isInSet == isNegated) {
+                        return false;
+                    }
+                    p = close + 1;
+                    ++s;
+                    break;
+                }
+                case '{': {
+                    const char *close = static_cast<const char *>(std::memchr(p, '}', patternEnd - p));
+                    if (close == nullptr) {
+                        return false;
+                    }
+                    const char *alternative = p + 1;
+                    while (true) {
+                        const char *comma = alternative;
+                        while (comma < close && *comma != ',') {
+                            ++comma;
+                        }
+                        const auto length = static_cast<size_t>(comma - alternative);
+                        if (std::strncmp(s, alternative, length) == 0 && MatchSegment(close + 1, patternEnd, s + length)) {
+                            return true;
+                        }
+                        if (comma == close) {
+                            return false;
+                        }
+                        alternative = comma + 1;
+                    }
+                }
+                default:
+                    if (*s != *p) {
+                        return false;
+                    }
+                    ++p;
+                    ++s;
+            }
+        }
+        return *s == '\0';
+    }
+
+    class AddressResolver {
+    public:
+        // a full cache is cleared, in case a controller sends an endless variety of patterns
+        static constexpr unsigned int maxCachedPatterns = 256;
+
+        // find what an address names; returns false if it is malformed, or names nothing
+        bool Resolve(const char *address, unsigned int numInstances, Targets &targets) {
+            if (std::strpbrk(address, "*?[]{}") == nullptr) {
+                return ResolvePlain(address, numInstances, targets);
+            }
+            const auto cached = cache.find(std::string_view(address));
+            if (cached != cache.end()) {
+                targets = cached->second;
+            } else {
+                if (cache.size() >= maxCachedPatterns) {
+                    cache.clear();
+                    keys.clear();
+                }
+                ResolvePattern(address, numInstances, targets);
+                keys.emplace_back(address);
+                cache.emplace(keys.back(), targets);
+            }
+            return targets.routes != 0 && targets.instances != 0;
+        }
+
+    private:
+        std::unordered_map<std::string_view, Targets> cache;
+        // storage for the cache's keys
+        std::deque<std::string> keys;
+
+        // `/mlp/<instance>` and `/layer/<layer>` prefixes, and the command segment, as pointer ranges
+        struct Segments {
+            const char *instance{nullptr};
+            const char *instanceEnd{nullptr};
+            const char *layer{nullptr};
+            const char *layerEnd{nullptr};
+            // the rest of the address, starting with its '/'
+            const char *command{nullptr};
+        };
+
+        static bool TakePrefix(const char *&address, const char *keyword, const char *&segment,
+                               const char *&segmentEnd) {
+            const size_t length = std::strlen(keyword);
+            if (std::strncmp(address, keyword, length) != 0) {
+                return true;
+            }
+            segment = address + length;
+            segmentEnd = std::strchr(segment, '/');
+            if (segmentEnd == nullptr || segmentEnd == segment) {
+                return false;
+            }
+            address = segmentEnd;
+            return true;
+        }
+
+        static bool Split(const char *address, Segments &segments) {
+            if (!TakePrefix(address, "/mlp/", segments.instance, segments.instanceEnd)
+                || !TakePrefix(address, "/layer/", segments.layer, segments.layerEnd)) {
+                return false;
+            }
+            segments.command = address;
+            return std::strchr(address + 1, '/') == nullptr;
+        }
+
+        static bool ParseIndex(const char *begin, const char *end, unsigned long int &index) {
+            char *parsedEnd;
+            index = std::strtoul(begin, &parsedEnd, 10);
+            return parsedEnd == end;
+        }
+
+        static bool ResolvePlain(const char *address, unsigned int numInstances, Targets &targets) {
+            Segments segments;
+            if (!Split(address, segments)) {
+                return false;
+            }
+            unsigned long int index = 0;
+            if (segments.instance != nullptr
+                && (!ParseIndex(segments.instance, segments.instanceEnd, index) || index >= numInstances)) {
+                return false;
+            }
+            targets.instances = uint64_t(1) << index;
+            targets.layers = 0;
+            if (segments.layer != nullptr) {
+                if (!ParseIndex(segments.layer, segments.layerEnd, index) || index >= numLoopLayers) {
+                    return false;
+                }
+                targets.layers = 1u << index;
+            }
+            const Route *route = Find(segments.command);
+            if (route == nullptr) {
+                return false;
+            }
+            targets.routes = 1u << (route - routes);
+            return true;
+        }
+
+        // match every part of a pattern against everything it could name
+        static void ResolvePattern(const char *address, unsigned int numInstances, Targets &targets) {
+            targets = Targets();
+            Segments segments;
+            if (!Split(address, segments)) {
+                return;
+            }
+            char name[16];
+            if (segments.instance == nullptr) {
+                targets.instances = 1;
+            } else {
+                for (unsigned int i = 0; i < numInstances && i < maxInstances; ++i) {
+                    std::snprintf(name, sizeof(name), "%u", i);
+                    if (MatchSegment(segments.instance, segments.instanceEnd, name)) {
+                        targets.instances |= uint64_t(1) << i;
+                    }
+                }
+            }
+            if (segments.layer != nullptr) {
+                for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                    std::snprintf(name, sizeof(name), "%u", i);
+                    if (MatchSegment(segments.layer, segments.layerEnd, name)) {
+                        targets.layers |= 1u << i;
+                    }
+                }
+                if (targets.layers == 0) {
+                    targets.instances = 0;
+                    return;
+                }
+            }
+            const char *command = segments.command + 1;
+            const char *commandEnd = command + std::strlen(command);
+            for (unsigned int i = 0; i < numRoutes; ++i) {
+                if (MatchSegment(command, commandEnd, routes[i].address + 1)) {
+                    targets.routes |= 1u << i;
+                }
+            }
+        }
+    };
+
+}
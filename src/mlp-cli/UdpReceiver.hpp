@@ -0,0 +1,113 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+//-----------------------------------------------------------------------------------
+// UDP receive socket that drains a burst of datagrams per system call (`recvmmsg`, on Linux),
+// so a flurry of messages from a controller costs one wakeup rather than one per packet.
+// other POSIX systems take one datagram per call.
+class UdpReceiver {
+public:
+    static constexpr unsigned int maxPackets = 64;
+    static constexpr unsigned int maxPacketSize = 8192;
+    // how long `Receive()` waits for the first datagram
+    static constexpr int timeoutMs = 100;
+
+    UdpReceiver() : buffer(maxPackets * maxPacketSize) {}
+
+    ~UdpReceiver() {
+        Close();
+    }
+
+    bool Open(int port, std::string &error) {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            error = std::string("can't create socket: ") + std::strerror(errno);
+            return false;
+        }
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            error = "can't bind port " + std::to_string(port) + ": " + std::strerror(errno);
+            Close();
+            return false;
+        }
+        timeval timeout{};
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#if defined(__linux__)
+        for (unsigned int i = 0; i < maxPackets; ++i) {
+            iovecs[i].iov_base = &buffer[i * maxPacketSize];
+            iovecs[i].iov_len = maxPacketSize;
+            headers[i].msg_hdr = {};
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_name = &sources[i];
+        }
+#endif
+        return true;
+    }
+
+    void Close() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // wait for datagrams (up to the timeout), and pass each to `onPacket(data, size, sourceAddress, sourcePort)`,
+    // with the address and port in host byte order. returns the number received
+    template<typename F>
+    int Receive(F &&onPacket) {
+#if defined(__linux__)
+        for (unsigned int i = 0; i < maxPackets; ++i) {
+            headers[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+        }
+        // block for the first datagram only, then take whatever else is already queued
+        const int count = recvmmsg(fd, headers, maxPackets, MSG_WAITFORONE, nullptr);
+        for (int i = 0; i < count; ++i) {
+            if ((headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0) {
+                continue;
+            }
+            onPacket(&buffer[i * maxPacketSize], static_cast<int>(headers[i].msg_len),
+                     ntohl(sources[i].sin_addr.s_addr), ntohs(sources[i].sin_port));
+        }
+        return count < 0 ? 0 : count;
+#else
+        sockaddr_in source{};
+        socklen_t sourceSize = sizeof(source);
+        const auto size = recvfrom(fd, buffer.data(), maxPacketSize, 0, reinterpret_cast<sockaddr *>(&source),
+                                   &sourceSize);
+        if (size < 0) {
+            return 0;
+        }
+        onPacket(buffer.data(), static_cast<int>(size), ntohl(source.sin_addr.s_addr), ntohs(source.sin_port));
+        return 1;
+#endif
+    }
+
+private:
+    int fd{-1};
+    std::vector<char> buffer;
+#if defined(__linux__)
+    mmsghdr headers[maxPackets]{};
+    iovec iovecs[maxPackets]{};
+    sockaddr_in sources[maxPackets]{};
+#endif
+};
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#if defined(__linux__)
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------------
+// wakes one waiting thread from the audio thread.
+// `Post()` never blocks or allocates, and only makes a system call when the waiter may be asleep;
+// posts while the waiter is busy collapse into one wakeup.
+// on Linux this is a futex; elsewhere a condition variable, with the waiter's timeout covering a missed notify
+class WakeSignal {
+    std::atomic<uint32_t> isPosted{0};
+#if !defined(__linux__)
+    std::mutex mutex;
+    std::condition_variable condition;
+#endif
+
+public:
+    void Post() {
+        if (isPosted.exchange(1, std::memory_order_release) != 0) {
+            return;
+        }
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&isPosted), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        // notifying without the lock can race with the waiter going to sleep; the timeout bounds the delay
+        condition.notify_one();
+#endif
+    }
+
+    // wait for a post, or the timeout; returns true if posted
+    bool Wait(std::chrono::milliseconds timeout) {
+        if (isPosted.exchange(0, std::memory_order_acquire) != 0) {
+            return true;
+        }
+#if defined(__linux__)
+        timespec ts{};
+        ts.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+        ts.tv_nsec = static_cast<long>((timeout.count() % 1000) * 1000000);
+        // sleeps only while nothing is posted
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&isPosted), FUTEX_WAIT_PRIVATE, 0, &ts, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, timeout, [this] { return isPosted.load(std::memory_order_relaxed) != 0; });
+#endif
+        return isPosted.exchange(0, std::memory_order_acquire) != 0;
+    }
+};
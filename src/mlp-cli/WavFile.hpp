@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+//-----------------------------------------------------------------------------------
+// minimal streaming WAV file I/O for offline rendering.
+// reads 16/24/32-bit integer or 32-bit float PCM, mono or stereo, as interleaved stereo float;
+// writes interleaved stereo 32-bit float; write errors stick, and are reported by `Write()` and `Close()`.
+
+class WavReader {
+    FILE *file{nullptr};
+    unsigned int numChannels{0};
+    unsigned int bitsPerSample{0};
+    bool isFloat{false};
+    unsigned long int framesLeft{0};
+    // raw bytes of one block, converted in place
+    std::string raw;
+
+public:
+    unsigned int sampleRate{0};
+    unsigned long int numFrames{0};
+
+    ~WavReader() {
+        Close();
+    }
+
+    // returns false, and describes the problem, if the file can't be read
+    bool Open(const char *path, std::string &error) {
+        file = std::fopen(path, "rb");
+        if (file == nullptr) {
+            error = std::string("can't open ") + path;
+            return false;
+        }
+        char header[12];
+        if (std::fread(header, 1, 12, file) != 12 || std::memcmp(header, "RIFF", 4) != 0
+            || std::memcmp(header + 8, "WAVE", 4) != 0) {
+            error = std::string("not a WAV file: ") + path;
+            return false;
+        }
+        bool hasFormat = false;
+        while (true) {
+            char id[4];
+            uint32_t size;
+            if (std::fread(id, 1, 4, file) != 4 || !ReadU32(size)) {
+                error = std::string("no audio data in ") + path;
+                return false;
+            }
+            if (std::memcmp(id, "fmt ", 4) == 0) {
+                uint16_t format, channels, blockAlign, bits;
+                uint32_t rate, byteRate;
+                if (!ReadU16(format) || !ReadU16(channels) || !ReadU32(rate) || !ReadU32(byteRate)
+                    || !ReadU16(blockAlign) || !ReadU16(bits)) {
+                    error = std::string("bad format chunk in ") + path;
+                    return false;
+                }
+                if (format == 0xfffe && size >= 26) {
+                    // extensible: the sub-format's first two bytes are the actual format tag
+                    uint16_t extraSize, validBits;
+                    uint32_t channelMask;
+                    ReadU16(extraSize);
+                    ReadU16(validBits);
+                    ReadU32(channelMask);
+                    ReadU16(format);
+                    std::fseek(file, static_cast<long>(size) - 26, SEEK_CUR);
+                } else {
+                    std::fseek(file, static_cast<long>(size) - 16, SEEK_CUR);
+                }
+                isFloat = format == 3;
+                if ((format != 1 && format != 3) || channels < 1 || channels > 2
+                    || (isFloat && bits != 32) || (!isFloat && bits != 16 && bits != 24 && bits != 32)) {
+                    error = std::string("unsupported sample format in ") + path;
+                    return false;
+                }
+                numChannels = channels;
+                bitsPerSample = bits;
+                sampleRate = rate;
+                hasFormat = true;
+            } else if (std::memcmp(id, "data", 4) == 0) {
+                if (!hasFormat) {
+                    error = std::string("data before format in ") + path;
+                    return false;
+                }
+                numFrames = framesLeft = size / (numChannels * bitsPerSample / 8);
+                return true;
+            } else {
+                // chunks are padded to even sizes
+                std::fseek(file, static_cast<long>(size + (size & 1)), SEEK_CUR);
+            }
+        }
+    }
+
+    // read up to the given number of frames as interleaved stereo; returns the number read
+    unsigned int Read(float *dst, unsigned int maxFrames) {
+        const auto n = static_cast<unsigned int>(maxFrames < framesLeft ? maxFrames : framesLeft);
+        const unsigned int bytesPerSample = bitsPerSample / 8;
+        raw.resize(static_cast<size_t>(n) * numChannels * bytesPerSample);
+        const size_t got = std::fread(&raw[0], numChannels * bytesPerSample, n, file);
+        const auto *p = reinterpret_cast<const unsigned char *>(raw.data());
+        for (size_t f = 0; f < got; ++f) {
+            float x[2];
+            for (unsigned int ch = 0; ch < numChannels; ++ch) {
+                x[ch] = Convert(p);
+                p += bytesPerSample;
+            }
+            dst[f * 2] = x[0];
+            dst[f * 2 + 1] = numChannels > 1 ? x[1] : x[0];
+        }
+        framesLeft -= got;
+        return static_cast<unsigned int>(got);
+    }
+
+    void Close() {
+        if (file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    bool ReadU16(uint16_t &x) {
+        unsigned char b[2];
+        if (std::fread(b, 1, 2, file) != 2) return false;
+        x = static_cast<uint16_t>(b[0] | (b[1] << 8));
+        return true;
+    }
+
+    bool ReadU32(uint32_t &x) {
+        unsigned char b[4];
+        if (std::fread(b, 1, 4, file) != 4) return false;
+        x = b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24);
+        return true;
+    }
+
+    float Convert(const unsigned char *p) const {
+        if (isFloat) {
+            uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+            float x;
+            std::memcpy(&x, &u, sizeof(x));
+            return x;
+        }
+        switch (bitsPerSample) {
+            case 16:
+                return static_cast<float>(static_cast<int16_t>(p[0] | (p[1] << 8))) * (1.f / 32768.f);
+            case 24: {
+                const uint32_t u = (p[0] << 8) | (p[1] << 16) | (static_cast<uint32_t>(p[2]) << 24);
+                return static_cast<float>(static_cast<int32_t>(u)) * (1.f / 2147483648.f);
+            }
+            case 32:
+            default: {
+                const uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+                return static_cast<float>(static_cast<int32_t>(u)) * (1.f / 2147483648.f);
+            }
+        }
+    }
+};
+
+class WavWriter {
+    FILE *file{nullptr};
+    unsigned long int numFrames{0};
+    // false after any failed write or seek
+    bool isOk{true};
+    // of the file this writer created, if any
+    std::string path;
+
+public:
+    ~WavWriter() {
+        Close();
+    }
+
+    bool Open(const char *aPath, unsigned int sampleRate, std::string &error) {
+        file = std::fopen(aPath, "wb");
+        if (file == nullptr) {
+            error = std::string("can't create ") + aPath;
+            return false;
+        }
+        path = aPath;
+        numFrames = 0;
+        isOk = true;
+        // sizes are filled in on closing
+        WriteBytes("RIFF\0\0\0\0WAVEfmt ", 16);
+        WriteU32(16);
+        WriteU16(3);
+        WriteU16(2);
+        WriteU32(sampleRate);
+        WriteU32(sampleRate * 8);
+        WriteU16(8);
+        WriteU16(32);
+        WriteBytes("data\0\0\0\0", 8);
+        if (!isOk) {
+            error = "can't write to " + path;
+        }
+        return isOk;
+    }
+
+    // write interleaved stereo frames; returns false if this or any earlier write failed
+    bool Write(const float *src, unsigned int frames) {
+        for (unsigned int i = 0; i < frames * 2; ++i) {
+            uint32_t u;
+            std::memcpy(&u, &src[i], sizeof(u));
+            WriteU32(u);
+        }
+        numFrames += frames;
+        return isOk;
+    }
+
+    // fill in the sizes and close; returns false if the file is incomplete
+    bool Close() {
+        if (file == nullptr) {
+            return isOk;
+        }
+        const auto dataBytes = static_cast<uint32_t>(numFrames * 8);
+        isOk = isOk && std::fseek(file, 4, SEEK_SET) == 0;
+        WriteU32(36 + dataBytes);
+        isOk = isOk && std::fseek(file, 40, SEEK_SET) == 0;
+        WriteU32(dataBytes);
+        isOk = std::fclose(file) == 0 && isOk;
+        file = nullptr;
+        return isOk;
+    }
+
+    // close, and delete the file, e.g. after a failed write, so that no truncated output is left behind
+    void Abandon() {
+        Close();
+        if (!path.empty()) {
+            std::remove(path.c_str());
+            path.clear();
+        }
+    }
+
+private:
+    void WriteBytes(const void *bytes, size_t size) {
+        isOk = isOk && std::fwrite(bytes, 1, size, file) == size;
+    }
+
+    void WriteU16(uint16_t x) {
+        const unsigned char b[2] = {static_cast<unsigned char>(x), static_cast<unsigned char>(x >> 8)};
+        WriteBytes(b, 2);
+    }
+
+    void WriteU32(uint32_t x) {
+        const unsigned char b[4] = {static_cast<unsigned char>(x), static_cast<unsigned char>(x >> 8),
+                                    static_cast<unsigned char>(x >> 16), static_cast<unsigned char>(x >> 24)};
+        WriteBytes(b, 4);
+    }
+};
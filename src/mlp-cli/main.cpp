@@ -1,7 +1,12 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <semaphore>
 #include <thread>
+#include <type_traits>
 
 /// rtaudio
 #include "RtAudio.h"
@@ -10,12 +15,23 @@
 #include "osc/OscOutboundPacketStream.h"
 #include "osc/OscReceivedElements.h"
 #include "osc/OscPacketListener.h"
+#include "osc/OscPrintReceivedElements.h"
 #include "ip/UdpSocket.h"
 
 #include "../Mlp.hpp"
+#include "../mlp/TraceWriter.hpp"
+#include "../mlp/WorkerPool.hpp"
+#include "BatchRender.hpp"
+#include "CommandSchedule.hpp"
+#include "OscDispatch.hpp"
+#include "OscPattern.hpp"
+#include "UdpReceiver.hpp"
+#include "WakeSignal.hpp"
 
 static const int oscRxPort = 9000;
 static const int oscTxPort = 9001;
+static const unsigned int sampleRate = 44100;
+static const int audioPriority = 90;
 
 #if 0
 static const int blockSize = 64;
@@ -26,13 +42,73 @@ static const int blockSize = 2048;
 using namespace mlp;
 
 
-Mlp m;
+// one looper per input channel (see --instances); with a single instance, input is stereo as usual
+static std::vector<std::unique_ptr<Mlp>> instances;
+// OSC commands waiting for each instance, applied on the audio thread
+static std::vector<std::unique_ptr<CommandSchedule>> schedules;
 RtAudio adac;
 
 static volatile bool shouldQuit = false;
 static volatile bool isMonoInput = false;
+// print every received message (see --osc-log); off by default, for high-rate controllers
+static bool isOscLogged = false;
 
-static std::vector<float> stereoBuffer;
+static std::vector<AudioSample> stereoBuffer;
+
+// with several instances: device channel counts, the pool that runs them,
+// and each instance's interleaved stereo input and output
+static unsigned int numDeviceInputs = 2;
+static unsigned int numDeviceOutputs = 2;
+static WorkerPool workerPool;
+// per-instance stereo blocks, sized once the stream is open
+static std::vector<std::vector<AudioSample>> instanceInput;
+static std::vector<std::vector<AudioSample>> instanceOutput;
+
+// posted by the audio thread when an output period finishes, to wake the OSC sender
+static WakeSignal outputsReady;
+
+// stream format matching the engine's samples; RtAudio's 32-bit integers are full scale, i.e. Q1.31
+static const RtAudioFormat audioFormat = std::is_same<AudioSample, float>::value ? RTAUDIO_FLOAT32 : RTAUDIO_SINT32;
+static_assert(sizeof(AudioSample) == 4, "stream samples must be 32 bits");
+
+//-----------------------------------------------------------------------------------
+// process every instance on the worker pool, each taking one input channel (as mono),
+// then mix their stereo outputs onto the device's output pairs
+void ProcessInstances(const AudioSample *in, AudioSample *out, unsigned int nBufferFrames) {
+    auto processInstance = [&](unsigned int i) {
+        auto &src = instanceInput[i];
+        auto &dst = instanceOutput[i];
+        for (unsigned int f = 0; f < nBufferFrames; ++f) {
+            src[f * 2] = in[f * numDeviceInputs + i];
+            src[f * 2 + 1] = in[f * numDeviceInputs + i];
+        }
+        schedules[i]->Process(*instances[i], src.data(), dst.data(), nBufferFrames, sampleRate);
+    };
+    const auto numInstances = static_cast<unsigned int>(instances.size());
+    workerPool.Run(numInstances, processInstance);
+
+    // mix in instance order, so the result doesn't depend on which worker finished first
+    std::fill(out, out + nBufferFrames * numDeviceOutputs, AudioSample{});
+    const unsigned int numPairs = numDeviceOutputs / 2;
+    for (unsigned int i = 0; i < numInstances; ++i) {
+        const unsigned int channel = (i % numPairs) * 2;
+        const auto &src = instanceOutput[i];
+        for (unsigned int f = 0; f < nBufferFrames; ++f) {
+            out[f * numDeviceOutputs + channel] += src[f * 2];
+            out[f * numDeviceOutputs + channel + 1] += src[f * 2 + 1];
+        }
+    }
+}
+
+// wake the sender if the block finished an output period (instances all run in step, so the first will do)
+void SignalOutputs() {
+    static unsigned long int lastOutputPeriodCount = 0;
+    const unsigned long int outputPeriodCount = instances[0]->GetOutputPeriodCount();
+    if (outputPeriodCount != lastOutputPeriodCount) {
+        lastOutputPeriodCount = outputPeriodCount;
+        outputsReady.Post();
+    }
+}
 
 //-----------------------------------------------------------------------------------
 int AudioCallback(void *outputBuffer, void *inputBuffer, unsigned int nBufferFrames, double streamTime,
@@ -52,6 +128,13 @@ int AudioCallback(void *outputBuffer, void *inputBuffer, unsigned int nBufferFra
     }
     return 0;
 #else
+    if (instances.size() > 1) {
+        ProcessInstances(static_cast<AudioSample *>(inputBuffer), static_cast<AudioSample *>(outputBuffer),
+                         nBufferFrames);
+        SignalOutputs();
+        return 0;
+    }
+
     //---------------------------------------------
     // FIXME: nasty hack for mono->stereo input conversion
     // we're using a std vector and allowing it to grow automatically
@@ -61,16 +144,19 @@ int AudioCallback(void *outputBuffer, void *inputBuffer, unsigned int nBufferFra
         if (stereoBuffer.size() < nBufferFrames * 2) {
             stereoBuffer.resize(nBufferFrames * 2);
         }
-        auto *in = static_cast<float *>(inputBuffer);
+        auto *in = static_cast<AudioSample *>(inputBuffer);
         for (int i = 0; i < nBufferFrames; ++i) {
             stereoBuffer[i * 2] = in[i];
             stereoBuffer[i * 2 + 1] = in[i];
         }
         inputBuffer = stereoBuffer.data();
-        m.ProcessAudioBlock(stereoBuffer.data(), static_cast<float *>(outputBuffer), nBufferFrames);
+        schedules[0]->Process(*instances[0], stereoBuffer.data(), static_cast<AudioSample *>(outputBuffer),
+                              nBufferFrames, sampleRate);
     } else {
-        m.ProcessAudioBlock(static_cast<float *>(inputBuffer), static_cast<float *>(outputBuffer), nBufferFrames);
+        schedules[0]->Process(*instances[0], static_cast<AudioSample *>(inputBuffer),
+                              static_cast<AudioSample *>(outputBuffer), nBufferFrames, sampleRate);
     }
+    SignalOutputs();
     return 0;
 #endif
 }
@@ -89,7 +175,23 @@ int InitAudio() {
     std::cout << "output device: " << outputDeviceInfo.name << std::endl;
 
     auto inch = inputDeviceInfo.inputChannels;
-    if (inch < 2) {
+    const auto numInstances = static_cast<unsigned int>(instances.size());
+    if (numInstances > 1) {
+        if (inch < numInstances) {
+            std::cerr << numInstances << " instances need as many input channels; only " << inch
+                      << " available!" << std::endl;
+            return 1;
+        }
+        // every instance's output goes to a stereo pair, sharing pairs if there aren't enough
+        unsigned int outch = std::min(outputDeviceInfo.outputChannels, numInstances * 2) & ~1u;
+        if (outch < 2) {
+            std::cerr << "need at least two output channels!" << std::endl;
+            return 1;
+        }
+        numDeviceInputs = iParams.nChannels = numInstances;
+        numDeviceOutputs = oParams.nChannels = outch;
+        std::cout << "hosting " << numInstances << " instances on " << outch << " output channels" << std::endl;
+    } else if (inch < 2) {
         if (inch < 1) {
             std::cerr << "no input channels available!" << std::endl;
             return 1;
@@ -105,15 +207,31 @@ int InitAudio() {
 
     RtAudio::StreamOptions options;
     options.flags = RTAUDIO_SCHEDULE_REALTIME;
-    options.priority = 90;
+    options.priority = audioPriority;
 
     unsigned int bufferFrames = blockSize;
+    for (auto &m: instances) {
+        m->SetSampleRate(sampleRate);
+    }
     try {
-        adac.openStream(&oParams, &iParams, RTAUDIO_FLOAT32, 44100, &bufferFrames, &AudioCallback, &m,
+        adac.openStream(&oParams, &iParams, audioFormat, sampleRate, &bufferFrames, &AudioCallback, nullptr,
                         &options);
+        // the device may not have taken the block size we asked for; every callback has the one it chose
+        if (numInstances > 1) {
+            instanceInput.assign(numInstances, std::vector<AudioSample>(bufferFrames * 2));
+            instanceOutput.assign(numInstances, std::vector<AudioSample>(bufferFrames * 2));
+        }
+        // the device reports one total for both directions; take it as an even split until measured.
+        // (set before starting, while this thread is still the only one changing parameters)
+        auto latency = static_cast<unsigned long int>(adac.getStreamLatency());
+        for (auto &m: instances) {
+            m->IndexParamChange(Mlp::IndexParamId::InputLatencyFrames, latency / 2);
+            m->IndexParamChange(Mlp::IndexParamId::OutputLatencyFrames, latency - latency / 2);
+        }
         adac.startStream();
         std::cout << "started audio device stream " << std::endl;
         std::cout << "buffer size = " << bufferFrames << std::endl;
+        std::cout << "reported stream latency = " << latency << " frames" << std::endl;
     } catch (std::exception &e) {
         std::cerr << "error starting audio device stream: " << e.what() << std::endl;
         return 1;
@@ -124,139 +242,372 @@ int InitAudio() {
 
 
 //-----------------------------------------------------------------------------------
+// messages are parsed on the receive thread, and applied on the audio thread (see CommandSchedule.hpp):
+// plain messages at the start of the next block, and messages in timed bundles on the frame they are due
 class OscListener : public osc::OscPacketListener {
 
+#if defined(_WIN32)
     std::unique_ptr<UdpListeningReceiveSocket> rxSocket;
+#else
+    UdpReceiver receiver;
+#endif
     std::unique_ptr<std::thread> rxThread;
+    dispatch::AddressResolver resolver;
+    // due time of the bundle being processed (see CommandSchedule::TimeTagToNanos), zero outside bundles
+    int64_t bundleTime{0};
 
 public:
     void Init() {
+#if defined(_WIN32)
         rxSocket = std::make_unique<UdpListeningReceiveSocket>(
             IpEndpointName(IpEndpointName::ANY_ADDRESS, oscRxPort),
             this);
+#else
+        std::string error;
+        if (!receiver.Open(oscRxPort, error)) {
+            std::cerr << error << std::endl;
+            return;
+        }
+#endif
 
         std::cout << "listening for input on port " << oscRxPort << "...\n";
 
         rxThread = std::make_unique<std::thread>([&] {
+#if defined(_WIN32)
             rxSocket->RunUntilSigInt();
+#else
+            while (!shouldQuit) {
+                receiver.Receive([this](const char *data, int size, unsigned long address, int port) {
+                    try {
+                        ProcessPacket(data, size, IpEndpointName(address, port));
+                    } catch (osc::Exception &e) {
+                        std::cout << "error while parsing packet: " << e.what() << "\n";
+                    }
+                });
+            }
+#endif
         });
         rxThread->detach();
     }
 
 protected:
+    void ProcessBundle(const osc::ReceivedBundle &bundle, const IpEndpointName &remoteEndpoint) override {
+        // a nested bundle tagged "now" runs with the bundle around it
+        const int64_t outerTime = bundleTime;
+        const int64_t time = CommandSchedule::TimeTagToNanos(bundle.TimeTag());
+        if (time != 0) {
+            bundleTime = time;
+        }
+        for (auto element = bundle.ElementsBegin(); element != bundle.ElementsEnd(); ++element) {
+            if (element->IsBundle()) {
+                ProcessBundle(osc::ReceivedBundle(*element), remoteEndpoint);
+            } else {
+                ProcessMessage(osc::ReceivedMessage(*element), remoteEndpoint);
+            }
+        }
+        bundleTime = outerTime;
+    }
+
     void ProcessMessage(const osc::ReceivedMessage &msg, const IpEndpointName &remoteEndpoint) override {
         (void) remoteEndpoint; // suppress unused parameter warning
 
-        try {
-            if (std::strcmp(msg.AddressPattern(), "/tap") == 0) {
-                osc::ReceivedMessageArgumentStream args = msg.ArgumentStream();
-                int idx {0};
-                args >> idx >> osc::EndMessage;
-                std::cout << "tap " << idx << std::endl;
-                m.Tap(static_cast<Mlp::TapId>(idx));
-            } else if (std::strcmp(msg.AddressPattern(), "/fparam") == 0) {
-                osc::ReceivedMessage::const_iterator arg = msg.ArgumentsBegin();
-                int idx = arg++->AsInt32();
-                float value = arg->AsFloat();
-                std::cout << "float param " << idx << " " << value << std::endl;
-                m.FloatParamChange(static_cast<Mlp::FloatParamId>(idx), value);
-            } else if (std::strcmp(msg.AddressPattern(), "/iparam") == 0) {
-                osc::ReceivedMessage::const_iterator arg = msg.ArgumentsBegin();
-                int idx = arg++->AsInt32();
-                auto value = arg->AsInt32();
-                m.IndexParamChange(static_cast<Mlp::IndexParamId>(idx), value);
-            } else if (std::strcmp(msg.AddressPattern(), "/bparam") == 0) {
-                osc::ReceivedMessage::const_iterator arg = msg.ArgumentsBegin();
-                int idx = arg++->AsInt32();
-                auto value = arg->AsBool();
-                m.BoolParamChange(static_cast<Mlp::BoolParamId>(idx), value);
-            } else if (std::strcmp(msg.AddressPattern(), "/quit") == 0) {
-                std::cout << "quit" << std::endl;
-                shouldQuit = true;
+        if (isOscLogged) {
+            std::cout << msg << std::endl;
+        }
+
+        // see OscPattern.hpp for the address forms, e.g. `/mlp/3/tap` or `/layer/*/ifparam`
+        const char *address = msg.AddressPattern();
+        const char *lastSegment = std::strrchr(address, '/');
+        if (lastSegment != nullptr && std::strcmp(lastSegment, "/quit") == 0) {
+            std::cout << "quit" << std::endl;
+            shouldQuit = true;
+            return;
+        }
+        dispatch::Targets targets;
+        if (!resolver.Resolve(address, static_cast<unsigned int>(instances.size()), targets)) {
+            if (isOscLogged) {
+                std::cout << "unknown address: " << address << std::endl;
+            }
+            return;
+        }
+        for (unsigned int r = 0; r < dispatch::numRoutes; ++r) {
+            if ((targets.routes & (1u << r)) == 0) {
+                continue;
+            }
+            // one command per instance, however many layers it covers
+            dispatch::Command command;
+            try {
+                dispatch::Parse(dispatch::routes[r], msg, targets.layers, command);
+            } catch (osc::Exception &e) {
+                std::cout << "error while parsing message: " << address << ": " << e.what() << "\n";
+                continue;
+            }
+            for (unsigned int i = 0; i < instances.size(); ++i) {
+                if ((targets.instances & (uint64_t(1) << i)) == 0) {
+                    continue;
+                }
+                if (!command.isDeferrable) {
+                    dispatch::Apply(*instances[i], command);
+                } else if (!schedules[i]->Push(command, bundleTime)) {
+                    std::cout << "command queue full; dropped " << address << std::endl;
+                }
             }
-        } catch (osc::Exception &e) {
-            std::cout << "error while parsing message: "
-                      << msg.AddressPattern() << ": " << e.what() << "\n";
         }
     }
 };
 
+// sends each instance's outputs to every subscriber, as one OSC bundle per output period.
+// the thread sleeps until the audio thread signals a finished period (see `outputsReady`).
+// addresses are prefixed with `/mlp/<n>` when there are several instances:
+//   /flags <layer> <mask>              layers with any flags; bit i is `LayerOutputFlagLabel[i]`
+//   /position <layer> <start> <end>    logical frames (int64) at the start and end of the period
+//   /peak <left> <right>               output peak levels
+//   /latency <frames>                  when a latency measurement completes
 class OscSender {
-    static constexpr int bufferSize = 1024;
+    static constexpr int bufferSize = 4096;
     char buffer[bufferSize];
 
-    std::unique_ptr<UdpTransmitSocket> txSocket;
+    std::vector<std::unique_ptr<UdpTransmitSocket>> txSockets;
     std::unique_ptr<std::thread> txThread;
 
-    //std::binary_semaphore dataReady{0};
-
 public:
 
-    OscSender() {
-        txSocket = std::make_unique<UdpTransmitSocket>(
-                IpEndpointName("localhost", oscTxPort));
+    // call before `Init()`; with no subscribers, outputs go to localhost
+    void AddSubscriber(const std::string &host, int port) {
+        txSockets.push_back(std::make_unique<UdpTransmitSocket>(IpEndpointName(host.c_str(), port)));
+        std::cout << "sending outputs to " << host << ":" << port << std::endl;
     }
 
     void Init() {
+        if (txSockets.empty()) {
+            AddSubscriber("localhost", oscTxPort);
+        }
         txThread = std::make_unique<std::thread>([&] {
+            std::vector<frame_t> lastMeasuredLatency(instances.size(), 0);
             while (!shouldQuit) {
-
-                auto &layerFlagsQ = m.GetLayerFlagsQ();
-                LayerFlagsMessageData flagsData;
-                /// FIXME: whoops, this is a hot loop!
-                /// i suppose we should use BlockingReaderWriterQueue with `wait_dequeue_timed`
-                /// but also means a separate thread per Q
-                while (layerFlagsQ.try_dequeue(flagsData)) {
-                    /// TODO: send the flags data... (as a blob? bool array? separate messages?)
-                    std::cout << "layer " << flagsData.layer << ": ";
-                    for (int i = 0; i < static_cast<int>(LayerOutputFlagId::Count); ++i) {
-                        if (flagsData.flags.Test(static_cast<LayerOutputFlagId>(i))) {
-                            std::cout << LayerOutputFlagLabel[i] << ", ";
-                        }
-                    }
-                    std::cout << std::endl;
+                // the timeout only lets the thread notice quitting
+                if (!outputsReady.Wait(std::chrono::milliseconds(100))) {
+                    continue;
                 }
-
-                auto &layerPositionQ = m.GetLayerPositionQ();
-                LayerPositionMessageData posData;
-                while (layerPositionQ.try_dequeue(posData)) {
-                    // TODO: send the position data...
-                    std::cout << "layer position: " << posData.layer << "; "
-                              << posData.positionRange[0] << " - " << posData.positionRange[1] << std::endl;
+                for (unsigned int index = 0; index < instances.size(); ++index) {
+                    SendInstanceOutputs(index, lastMeasuredLatency[index]);
                 }
-                std::this_thread::sleep_for(std::chrono::milliseconds(20));
-
             }
         });
     }
 
-    void SendInt(const char *address, int value) {
+    void Finish() {
+        if (txThread != nullptr) {
+            txThread->join();
+            txThread.reset();
+        }
+    }
+
+    void SendInstanceOutputs(unsigned int index, frame_t &lastMeasuredLatency) {
+        Mlp &m = *instances[index];
+
+        // if the thread fell behind, periods merge: flags accumulate, and positions span them all
+        LayerOutputFlags flags[numLoopLayers];
+        frame_t positionRange[numLoopLayers][2];
+        bool hasPosition[numLoopLayers]{};
+        LayerFlagsMessageData flagsData;
+        while (m.GetLayerFlagsQ().try_dequeue(flagsData)) {
+            flags[flagsData.layer].Merge(flagsData.flags);
+        }
+        LayerPositionMessageData posData;
+        bool hasOutputs = false;
+        while (m.GetLayerPositionQ().try_dequeue(posData)) {
+            if (!hasPosition[posData.layer]) {
+                hasPosition[posData.layer] = true;
+                positionRange[posData.layer][0] = posData.positionRange[0];
+            }
+            positionRange[posData.layer][1] = posData.positionRange[1];
+            hasOutputs = true;
+        }
+        const frame_t measuredLatency = m.GetMeasuredLatency();
+        const bool hasLatency = measuredLatency != lastMeasuredLatency;
+        if (!hasOutputs && !hasLatency) {
+            return;
+        }
+
+        char address[32];
         osc::OutboundPacketStream p(buffer, bufferSize);
-        p << osc::BeginMessage(address) << value << osc::EndMessage;
-        txSocket->Send(p.Data(), p.Size());
+        p << osc::BeginBundleImmediate;
+        for (unsigned int i = 0; i < numLoopLayers; ++i) {
+            if (flags[i].Any()) {
+                p << osc::BeginMessage(Address(address, index, "/flags")) << static_cast<int32_t>(i)
+                  << static_cast<int32_t>(flags[i].flags.to_ulong()) << osc::EndMessage;
+            }
+        }
+        for (unsigned int i = 0; i < numLoopLayers; ++i) {
+            if (hasPosition[i]) {
+                p << osc::BeginMessage(Address(address, index, "/position")) << static_cast<int32_t>(i)
+                  << static_cast<osc::int64>(positionRange[i][0]) << static_cast<osc::int64>(positionRange[i][1])
+                  << osc::EndMessage;
+            }
+        }
+        if (hasOutputs) {
+            p << osc::BeginMessage(Address(address, index, "/peak")) << m.GetOutputPeak(0) << m.GetOutputPeak(1)
+              << osc::EndMessage;
+        }
+        if (hasLatency) {
+            lastMeasuredLatency = measuredLatency;
+            p << osc::BeginMessage(Address(address, index, "/latency")) << static_cast<int32_t>(measuredLatency)
+              << osc::EndMessage;
+        }
+        p << osc::EndBundle;
+        for (auto &socket: txSockets) {
+            socket->Send(p.Data(), p.Size());
+        }
     }
 
-//
-//    void SendFloat(const char *address, float value) {
-//        osc::OutboundPacketStream p(buffer, bufferSize);
-//        p << osc::BeginMessage(address) << value << osc::EndMessage;
-//        txSocket->Send(p.Data(), p.Size());
-//    }
-//
+private:
+    // the address for one instance's output, which is just `name` with a single instance
+    static const char *Address(char (&address)[32], unsigned int index, const char *name) {
+        if (instances.size() == 1) {
+            return name;
+        }
+        std::snprintf(address, sizeof(address), "/mlp/%u%s", index, name);
+        return address;
+    }
+};
 
-//
-//    void SendBool(const char *address, bool value) {
-//        osc::OutboundPacketStream p(buffer, bufferSize);
-//        p << osc::BeginMessage(address) << value << osc::EndMessage;
-//        txSocket->Send(p.Data(), p.Size());
-//    }
+//-----------------------------------------------------------------------------------
+// drains the (first instance's) kernel's condition/action trace to a Chrome trace JSON file
+class TraceExporter {
+    std::ofstream file;
+    std::unique_ptr<TraceWriter> writer;
+    std::unique_ptr<std::thread> thread;
+    volatile bool shouldStop{false};
+
+    void Drain() {
+        auto &trace = instances[0]->GetTrace();
+        TraceEvent event;
+        frame_t lastTime = 0;
+        while (trace.Read(event)) {
+            writer->Write(event);
+            lastTime = event.time;
+        }
+        unsigned int dropped = trace.TakeDroppedCount();
+        if (dropped > 0) {
+            writer->WriteDropped(lastTime, dropped);
+        }
+    }
+
+public:
+    bool Init(const char *path) {
+        file.open(path);
+        if (!file) {
+            std::cerr << "couldn't open trace file: " << path << std::endl;
+            return false;
+        }
+        writer = std::make_unique<TraceWriter>(file, sampleRate);
+        writer->Begin();
+        instances[0]->GetTrace().SetEnabled(true);
+        std::cout << "writing trace to " << path << std::endl;
+        thread = std::make_unique<std::thread>([this] {
+            while (!shouldStop) {
+                Drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        });
+        return true;
+    }
+
+    void Finish() {
+        if (!thread) {
+            return;
+        }
+        instances[0]->GetTrace().SetEnabled(false);
+        shouldStop = true;
+        thread->join();
+        Drain();
+        writer->End();
+    }
 };
 
 static OscListener listener;
 static OscSender sender;
+static TraceExporter traceExporter;
 
 //-----------------------------------------------------------------------------------
-int main() {
+int main(int argc, char **argv) {
+    const char *tracePath = nullptr;
+    bool shouldCompress = false;
+    int numInstances = 1;
+    int numWorkers = -1;
+    int numLayerWorkers = 0;
+    const char *batchPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--compress") == 0) {
+            shouldCompress = true;
+        } else if (std::strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            numInstances = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            numWorkers = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--layer-workers") == 0 && i + 1 < argc) {
+            numLayerWorkers = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--osc-send") == 0 && i + 1 < argc) {
+            // <host>:<port>, or just <port> on this machine
+            const std::string target = argv[++i];
+            const auto colon = target.find_last_of(':');
+            if (colon == std::string::npos) {
+                sender.AddSubscriber("localhost", std::atoi(target.c_str()));
+            } else {
+                sender.AddSubscriber(target.substr(0, colon), std::atoi(target.c_str() + colon + 1));
+            }
+        } else if (std::strcmp(argv[i], "--osc-log") == 0) {
+            isOscLogged = true;
+        } else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else {
+            numInstances = 0;
+            break;
+        }
+    }
+    if (numInstances < 1 || numInstances > static_cast<int>(dispatch::maxInstances)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--trace <file.json>] [--compress] [--instances <count>] [--workers <count>]"
+                  << " [--layer-workers <count>] [--osc-send <host:port>]... [--osc-log]" << std::endl;
+        std::cerr << "       " << argv[0] << " --batch <manifest> [--workers <count>]" << std::endl;
+        return 1;
+    }
+
+    if (batchPath != nullptr) {
+        // offline: no audio device or OSC
+        return batch::Run(batchPath, static_cast<unsigned int>(std::max(numWorkers, 0))) == 0 ? 0 : 1;
+    }
+
+    for (int i = 0; i < numInstances; ++i) {
+        instances.push_back(std::make_unique<Mlp>());
+        schedules.push_back(std::make_unique<CommandSchedule>());
+    }
+    if (numInstances > 1) {
+        // by default, one worker per core besides the audio thread, up to one per instance
+        if (numWorkers < 0) {
+            numWorkers = std::min(numInstances, static_cast<int>(std::thread::hardware_concurrency())) - 1;
+        }
+        // the audio thread joins in, so workers are pinned from the second core
+        workerPool.Start(static_cast<unsigned int>(std::max(numWorkers, 0)), 1, audioPriority);
+        std::cout << "processing " << numInstances << " instances on " << workerPool.GetNumWorkers()
+                  << " workers" << std::endl;
+    }
+    if (numLayerWorkers > 0) {
+        // each instance's layers get their own pool, pinned after the instance workers
+        int firstCore = 1 + std::max(numWorkers, 0);
+        for (auto &m: instances) {
+            m->SetLayerWorkers(static_cast<unsigned int>(numLayerWorkers), firstCore, audioPriority);
+            firstCore += numLayerWorkers;
+        }
+        std::cout << "processing layers on " << numLayerWorkers << " workers per instance" << std::endl;
+    }
+
+    if (tracePath != nullptr && !traceExporter.Init(tracePath)) {
+        return 1;
+    }
+
     if (InitAudio()) {
         return 1;
     }
@@ -265,6 +616,13 @@ int main() {
 //        return 1;
 //    }
 
+    if (shouldCompress) {
+        std::cout << "compressing idle layers" << std::endl;
+        for (auto &m: instances) {
+            m->SetIdleCompression(true);
+        }
+    }
+
     listener.Init();
     sender.Init();
 
@@ -273,5 +631,11 @@ int main() {
         std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
     }
 
+    for (auto &m: instances) {
+        m->SetIdleCompression(false);
+    }
+    sender.Finish();
+    traceExporter.Finish();
+    workerPool.Stop();
     return 0;
 }
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Constants.hpp"
+#include "LayerBehavior.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // a compiled set of behaviors, one per layer.
+    // built on a control thread, then copied into the kernel's tables at a block boundary
+    struct BehaviorProgram {
+        std::array<LayerBehavior, numLoopLayers> layer;
+
+        BehaviorProgram() {
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                layer[i].layerIndex = i;
+                layer[i].Clear();
+            }
+        }
+    };
+
+    //------------------------------------------------
+    // a small declarative language for layer behaviors.
+    // statements are separated by newlines or ';', and '#' starts a comment.
+    // keywords are case-insensitive, and commas separate list items like whitespace does.
+    // modes, conditions and actions are named by their labels, with or without underscores.
+    //
+    //   layers <sel>...              select the layers that following statements apply to (default: all)
+    //                                <sel> is 'all', a layer index 'n', or a range 'n-m'
+    //   clear                        remove all bindings and quantization from the selected layers
+    //   mode <label>                 load a built-in mode, e.g. 'mult_q' (see LayerBehaviorModeIdLabel)
+    //   quantize <what>...           <what> is 'open', 'close', 'both' or 'none'
+    //   on <condition> <action> <target>... [unless inner|outer] [count <n>]
+    //                                <condition> is 'open', 'close', 'trigger' or 'wrap'
+    //                                <action> is 'reset', 'restart', 'pause', 'resume', 'storetrigger',
+    //                                  'storereset', 'enableloop', 'disableloop' or 'rearm'
+    //                                <target> is 'self', 'below', 'above', 'others', or a <sel> as above
+    //
+    // e.g., one leader whose next two passes restart three followers, counted again whenever layer 1 closes:
+    //
+    //   layers 0; on wrap restart 1-3 count 2
+    //   layers 1; on close rearm 0
+    //
+    // relative targets are resolved for each selected layer when the script is compiled.
+    // compiling allocates, and must not be done on the audio thread
+    class BehaviorScript {
+    public:
+        // compile a script into a program; on failure, returns false and describes the first error
+        static bool Compile(const std::string &text, BehaviorProgram &program, std::string &error) {
+            Parser parser{program, error};
+            std::vector<std::string> tokens;
+            unsigned int lineNumber = 1;
+            std::string statement;
+            for (size_t i = 0; i <= text.size(); ++i) {
+                const char c = i < text.size() ? text[i] : '\n';
+                if (c == '\n' || c == ';') {
+                    Tokenize(statement, tokens);
+                    if (!tokens.empty() && !parser.Statement(tokens, lineNumber)) {
+                        return false;
+                    }
+                    statement.clear();
+                    if (c == '\n') {
+                        lineNumber++;
+                    }
+                } else {
+                    statement.push_back(c);
+                }
+            }
+            return true;
+        }
+
+    private:
+        static void Tokenize(const std::string &statement, std::vector<std::string> &tokens) {
+            tokens.clear();
+            std::string token;
+            for (char c: statement) {
+                if (c == '#') {
+                    break;
+                }
+                if (std::isspace(static_cast<unsigned char>(c)) || c == ',') {
+                    if (!token.empty()) {
+                        tokens.push_back(token);
+                        token.clear();
+                    }
+                } else {
+                    token.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+                }
+            }
+            if (!token.empty()) {
+                tokens.push_back(token);
+            }
+        }
+
+        static bool ParseIndex(const std::string &token, unsigned int &index) {
+            if (token.empty() || token.size() > 2) {
+                return false;
+            }
+            for (char c: token) {
+                if (!std::isdigit(static_cast<unsigned char>(c))) {
+                    return false;
+                }
+            }
+            index = static_cast<unsigned int>(std::atoi(token.c_str()));
+            return index < numLoopLayers;
+        }
+
+        // parse 'all', 'n' or 'n-m' into a layer mask
+        static bool ParseLayerSet(const std::string &token, LayerMask &mask) {
+            if (token == "all") {
+                mask = allLayersMask;
+                return true;
+            }
+            unsigned int first, last;
+            auto dash = token.find('-');
+            if (dash == std::string::npos) {
+                if (!ParseIndex(token, first)) {
+                    return false;
+                }
+                last = first;
+            } else if (!ParseIndex(token.substr(0, dash), first)
+                       || !ParseIndex(token.substr(dash + 1), last)
+                       || last < first) {
+                return false;
+            }
+            mask = 0;
+            for (unsigned int i = first; i <= last; ++i) {
+                mask |= 1u << i;
+            }
+            return true;
+        }
+
+        // whether a (lowercase) token names a label, ignoring case and underscores,
+        // so 'storetrigger' and 'store_trigger' both name STORE_TRIGGER
+        static bool IsLabel(const std::string &token, const char *label) {
+            size_t i = 0;
+            for (const char *c = label; *c != '\0'; ++c) {
+                if (*c == '_') {
+                    continue;
+                }
+                while (i < token.size() && token[i] == '_') {
+                    ++i;
+                }
+                if (i == token.size() || token[i] != std::tolower(static_cast<unsigned char>(*c))) {
+                    return false;
+                }
+                ++i;
+            }
+            while (i < token.size() && token[i] == '_') {
+                ++i;
+            }
+            return i == token.size();
+        }
+
+        template<typename Id, int numIds, int labelSize>
+        static bool ParseName(const std::string &token, const char (&labels)[numIds][labelSize], Id &id) {
+            for (int i = 0; i < numIds; ++i) {
+                if (IsLabel(token, labels[i])) {
+                    id = static_cast<Id>(i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        struct Parser {
+            BehaviorProgram &program;
+            std::string &error;
+            LayerMask selection{allLayersMask};
+
+            bool Fail(unsigned int lineNumber, const std::string &message) {
+                std::ostringstream ss;
+                ss << "line " << lineNumber << ": " << message;
+                error = ss.str();
+                return false;
+            }
+
+            template<typename F>
+            void ForEachSelected(F f) {
+                for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                    if (selection & (1u << i)) {
+                        f(program.layer[i]);
+                    }
+                }
+            }
+
+            bool Statement(const std::vector<std::string> &tokens, unsigned int lineNumber) {
+                const std::string &keyword = tokens[0];
+                if (keyword == "layers") {
+                    return Layers(tokens, lineNumber);
+                }
+                if (keyword == "clear") {
+                    ForEachSelected([](LayerBehavior &behavior) { behavior.Clear(); });
+                    return true;
+                }
+                if (keyword == "mode") {
+                    return Mode(tokens, lineNumber);
+                }
+                if (keyword == "quantize") {
+                    return Quantize(tokens, lineNumber);
+                }
+                if (keyword == "on") {
+                    return On(tokens, lineNumber);
+                }
+                return Fail(lineNumber, "unknown statement '" + keyword + "'");
+            }
+
+            bool Layers(const std::vector<std::string> &tokens, unsigned int lineNumber) {
+                if (tokens.size() < 2) {
+                    return Fail(lineNumber, "expected layers");
+                }
+                LayerMask mask = 0;
+                for (size_t i = 1; i < tokens.size(); ++i) {
+                    LayerMask m;
+                    if (!ParseLayerSet(tokens[i], m)) {
+                        return Fail(lineNumber, "bad layer selection '" + tokens[i] + "'");
+                    }
+                    mask |= m;
+                }
+                selection = mask;
+                return true;
+            }
+
+            bool Mode(const std::vector<std::string> &tokens, unsigned int lineNumber) {
+                if (tokens.size() != 2) {
+                    return Fail(lineNumber, "expected a mode name");
+                }
+                LayerBehaviorModeId mode;
+                if (ParseName(tokens[1], LayerBehaviorModeIdLabel, mode)) {
+                    ForEachSelected([mode](LayerBehavior &behavior) { SetLayerBehaviorMode(behavior, mode); });
+                    return true;
+                }
+                return Fail(lineNumber, "unknown mode '" + tokens[1] + "'");
+            }
+
+            bool Quantize(const std::vector<std::string> &tokens, unsigned int lineNumber) {
+                if (tokens.size() < 2) {
+                    return Fail(lineNumber, "expected 'open', 'close', 'both' or 'none'");
+                }
+                bool open = false;
+                bool close = false;
+                for (size_t i = 1; i < tokens.size(); ++i) {
+                    if (tokens[i] == "open") {
+                        open = true;
+                    } else if (tokens[i] == "close") {
+                        close = true;
+                    } else if (tokens[i] == "both") {
+                        open = close = true;
+                    } else if (tokens[i] != "none") {
+                        return Fail(lineNumber, "bad quantize option '" + tokens[i] + "'");
+                    }
+                }
+                ForEachSelected([open, close](LayerBehavior &behavior) {
+                    behavior.quantizeOpen = open;
+                    behavior.quantizeClose = close;
+                });
+                return true;
+            }
+
+            bool On(const std::vector<std::string> &tokens, unsigned int lineNumber) {
+                if (tokens.size() < 4) {
+                    return Fail(lineNumber, "expected 'on <condition> <action> <target>...'");
+                }
+                LayerConditionId condition;
+                if (!ParseName(tokens[1], LayerConditionIdLabel, condition)) {
+                    return Fail(lineNumber, "unknown condition '" + tokens[1] + "'");
+                }
+                LayerActionId action;
+                if (!ParseName(tokens[2], LayerActionIdLabel, action)) {
+                    return Fail(lineNumber, "unknown action '" + tokens[2] + "'");
+                }
+
+                // targets, as absolute layers plus relative layers (resolved per selected layer)
+                LayerMask absolute = 0;
+                bool self = false, below = false, above = false, others = false;
+                LayerActionGuard guard = LayerActionGuard::Always;
+                int count = -1;
+                size_t i = 3;
+                for (; i < tokens.size(); ++i) {
+                    const std::string &t = tokens[i];
+                    LayerMask m;
+                    if (t == "unless" || t == "count") {
+                        break;
+                    } else if (t == "self") {
+                        self = true;
+                    } else if (t == "below") {
+                        below = true;
+                    } else if (t == "above") {
+                        above = true;
+                    } else if (t == "others") {
+                        others = true;
+                    } else if (ParseLayerSet(t, m)) {
+                        absolute |= m;
+                    } else {
+                        return Fail(lineNumber, "bad target '" + t + "'");
+                    }
+                }
+                if (i == 3) {
+                    return Fail(lineNumber, "expected at least one target");
+                }
+                while (i < tokens.size()) {
+                    if (i + 1 >= tokens.size()) {
+                        return Fail(lineNumber, "expected a value after '" + tokens[i] + "'");
+                    }
+                    const std::string &value = tokens[i + 1];
+                    if (tokens[i] == "unless" && value == "inner") {
+                        guard = LayerActionGuard::NotInner;
+                    } else if (tokens[i] == "unless" && value == "outer") {
+                        guard = LayerActionGuard::NotOuter;
+                    } else if (tokens[i] == "count" && !value.empty()
+                               && value.find_first_not_of("0123456789") == std::string::npos) {
+                        count = std::atoi(value.c_str());
+                    } else {
+                        return Fail(lineNumber, "bad option '" + tokens[i] + " " + value + "'");
+                    }
+                    i += 2;
+                }
+
+                bool isFull = false;
+                ForEachSelected([&](LayerBehavior &behavior) {
+                    LayerMask targets = absolute;
+                    if (self) targets |= behavior.SelfMask();
+                    if (below) targets |= behavior.BelowMask();
+                    if (above) targets |= behavior.AboveMask();
+                    if (others) targets |= allLayersMask & ~behavior.SelfMask();
+                    if (!behavior.AddAction(condition, action, targets, guard, count)) {
+                        isFull = true;
+                    }
+                });
+                if (isFull) {
+                    return Fail(lineNumber, "too many actions on condition '" + tokens[1] + "'");
+                }
+                return true;
+            }
+        };
+    };
+
+}
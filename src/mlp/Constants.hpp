@@ -12,8 +12,14 @@ namespace mlp
     template<class T>
     constexpr T pi_2 = T(0.5) * pi<T>;
 
-    static constexpr frame_t bufferFrames = 1 << 25;
+    /// length of every loop buffer; builds may shorten it, e.g. -DMLP_BUFFER_FRAMES=262144 for tests
+#ifndef MLP_BUFFER_FRAMES
+#define MLP_BUFFER_FRAMES (1 << 25)
+#endif
+    static constexpr frame_t bufferFrames = MLP_BUFFER_FRAMES;
     static constexpr int numLoopChannels = 2;
     static constexpr int numLoopLayers = 4;
+    // number of overlapping read/write voices per layer
+    static constexpr int numLayerVoices = 4;
     static constexpr unsigned int framesPerOutput = 1 << 10;
 }
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <math.h>
+
+namespace mlp {
+
+    //------------------------------------------------
+    // fixed-point number types, for building the engine without floating-point hardware.
+    // each wraps a raw integer; arithmetic saturates where the result could overflow.
+    // conversions from float are for control-rate values only
+
+    namespace fixed {
+        inline int32_t Saturate(int64_t x) {
+            if (x > INT32_MAX) return INT32_MAX;
+            if (x < INT32_MIN) return INT32_MIN;
+            return static_cast<int32_t>(x);
+        }
+
+        inline int64_t FromFloat(float x, int fractionBits) {
+            return static_cast<int64_t>(llrintf(ldexpf(x, fractionBits)));
+        }
+    }
+
+    // Q16.16, for gains and levels
+    struct q16 {
+        static constexpr int fractionBits = 16;
+        static constexpr int32_t one = 1 << fractionBits;
+        int32_t raw{0};
+
+        static constexpr q16 FromRaw(int32_t aRaw) {
+            q16 x;
+            x.raw = aRaw;
+            return x;
+        }
+
+        static q16 FromFloat(float x) {
+            return FromRaw(fixed::Saturate(fixed::FromFloat(x, fractionBits)));
+        }
+
+        float ToFloat() const {
+            return ldexpf(static_cast<float>(raw), -fractionBits);
+        }
+
+        q16 operator+(q16 b) const { return FromRaw(fixed::Saturate(int64_t(raw) + b.raw)); }
+        q16 operator-(q16 b) const { return FromRaw(fixed::Saturate(int64_t(raw) - b.raw)); }
+        q16 operator*(q16 b) const { return FromRaw(fixed::Saturate((int64_t(raw) * b.raw) >> fractionBits)); }
+        q16 &operator+=(q16 b) { return *this = *this + b; }
+        q16 &operator*=(q16 b) { return *this = *this * b; }
+        bool operator==(q16 b) const { return raw == b.raw; }
+        bool operator!=(q16 b) const { return raw != b.raw; }
+        bool operator<(q16 b) const { return raw < b.raw; }
+        bool operator>(q16 b) const { return raw > b.raw; }
+        bool operator<=(q16 b) const { return raw <= b.raw; }
+        bool operator>=(q16 b) const { return raw >= b.raw; }
+    };
+
+    // Q1.31, for audio samples in [-1, 1)
+    struct q31 {
+        static constexpr int fractionBits = 31;
+        int32_t raw{0};
+
+        static constexpr q31 FromRaw(int32_t aRaw) {
+            q31 x;
+            x.raw = aRaw;
+            return x;
+        }
+
+        static q31 FromFloat(float x) {
+            return FromRaw(fixed::Saturate(fixed::FromFloat(x, fractionBits)));
+        }
+
+        float ToFloat() const {
+            return ldexpf(static_cast<float>(raw), -fractionBits);
+        }
+
+        q31 operator+(q31 b) const { return FromRaw(fixed::Saturate(int64_t(raw) + b.raw)); }
+        q31 operator-(q31 b) const { return FromRaw(fixed::Saturate(int64_t(raw) - b.raw)); }
+        q31 operator*(q16 g) const { return FromRaw(fixed::Saturate((int64_t(raw) * g.raw) >> q16::fractionBits)); }
+        q31 &operator+=(q31 b) { return *this = *this + b; }
+        q31 &operator*=(q16 g) { return *this = *this * g; }
+        bool operator==(q31 b) const { return raw == b.raw; }
+        bool operator!=(q31 b) const { return raw != b.raw; }
+        bool operator<(q31 b) const { return raw < b.raw; }
+        bool operator>(q31 b) const { return raw > b.raw; }
+    };
+
+    inline q31 operator*(q16 g, q31 x) {
+        return x * g;
+    }
+
+    // Q2.30, for fade and switch phases in [0, 1], which need finer increments than Q16.16 has
+    struct q30 {
+        static constexpr int fractionBits = 30;
+        static constexpr int32_t one = 1 << fractionBits;
+        int32_t raw{0};
+
+        static constexpr q30 FromRaw(int32_t aRaw) {
+            q30 x;
+            x.raw = aRaw;
+            return x;
+        }
+
+        static q30 FromFloat(float x) {
+            return FromRaw(fixed::Saturate(fixed::FromFloat(x, fractionBits)));
+        }
+
+        float ToFloat() const {
+            return ldexpf(static_cast<float>(raw), -fractionBits);
+        }
+
+        q30 operator+(q30 b) const { return FromRaw(fixed::Saturate(int64_t(raw) + b.raw)); }
+        q30 operator-(q30 b) const { return FromRaw(fixed::Saturate(int64_t(raw) - b.raw)); }
+        q30 operator-() const { return FromRaw(-raw); }
+        q30 &operator+=(q30 b) { return *this = *this + b; }
+        q30 &operator-=(q30 b) { return *this = *this - b; }
+        bool operator<=(q30 b) const { return raw <= b.raw; }
+        bool operator>=(q30 b) const { return raw >= b.raw; }
+    };
+
+    // Q47.16 in 64 bits, for (fractional) frame counts such as read offsets
+    struct qframes {
+        static constexpr int fractionBits = 16;
+        int64_t raw{0};
+
+        static constexpr qframes FromRaw(int64_t aRaw) {
+            qframes x;
+            x.raw = aRaw;
+            return x;
+        }
+
+        static qframes FromFloat(float x) {
+            return FromRaw(fixed::FromFloat(x, fractionBits));
+        }
+
+        float ToFloat() const {
+            return static_cast<float>(ldexp(static_cast<double>(raw), -fractionBits));
+        }
+
+        qframes operator+(qframes b) const { return FromRaw(raw + b.raw); }
+        qframes &operator+=(qframes b) { return *this = *this + b; }
+        bool operator==(qframes b) const { return raw == b.raw; }
+    };
+
+    //------------------------------------------------
+    // conversions between float and any per-frame value type
+
+    template<typename T>
+    inline T FromFloat(float x) {
+        return T::FromFloat(x);
+    }
+
+    template<>
+    inline float FromFloat<float>(float x) {
+        return x;
+    }
+
+    inline float ToFloat(float x) {
+        return x;
+    }
+
+    template<typename T>
+    inline float ToFloat(T x) {
+        return x.ToFloat();
+    }
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <math.h>
+
+#include "Constants.hpp"
+#include "SampleFormat.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // a small matrix of gains from input channels to output channels,
+    // with a target that is approached linearly over the course of one block.
+    // the target is computed at control rate, so there is no per-sample trig here.
+    // targets are float; per-frame gains are in the given number format (see SampleFormat.hpp)
+    template<int numInputs, int numOutputs, typename Format = LoopFormat>
+    struct GainMatrix {
+        typedef std::array<std::array<float, numInputs>, numOutputs> Matrix;
+        typedef typename Format::Gain Gain;
+        typedef typename Format::Audio Audio;
+        typedef std::array<std::array<Gain, numInputs>, numOutputs> Gains;
+
+        static constexpr Matrix Identity() {
+            Matrix m{};
+            for (int i = 0; i < numOutputs; ++i) {
+                for (int j = 0; j < numInputs; ++j) {
+                    m[i][j] = (i == j) ? 1.f : 0.f;
+                }
+            }
+            return m;
+        }
+
+        // current (per-frame) gains
+        Gains gain{Convert(Identity())};
+        // gains at the end of the current block's ramp
+        Matrix blockEnd{Identity()};
+        // requested gains
+        Matrix target{Identity()};
+        // per-frame gain increments for the current block
+        Gains delta{};
+        // true when no interpolation is needed this block
+        bool isSettled{true};
+
+        void SetTarget(const Matrix &aTarget) {
+            target = aTarget;
+        }
+
+        // call once per block, before processing any frames
+        void BeginBlock(unsigned int numFrames) {
+            // snap to the end of the last ramp,
+            // in case not all frames were advanced (e.g. if the layer was stopped)
+            if (blockEnd == target || numFrames == 0) {
+                blockEnd = target;
+                gain = Convert(blockEnd);
+                isSettled = true;
+                return;
+            }
+            gain = Convert(blockEnd);
+            const float scale = 1.f / static_cast<float>(numFrames);
+            for (int i = 0; i < numOutputs; ++i) {
+                for (int j = 0; j < numInputs; ++j) {
+                    delta[i][j] = FromFloat<Gain>((target[i][j] - blockEnd[i][j]) * scale);
+                }
+            }
+            blockEnd = target;
+            isSettled = false;
+        }
+
+        // call once per frame
+        void Advance() {
+            if (isSettled) return;
+            for (int i = 0; i < numOutputs; ++i) {
+                for (int j = 0; j < numInputs; ++j) {
+                    gain[i][j] += delta[i][j];
+                }
+            }
+        }
+
+        // mix an input frame into an output frame, with additional scaling
+        void Apply(const Audio *src, Audio *dst, Gain level) const {
+            for (int i = 0; i < numOutputs; ++i) {
+                Audio y{};
+                for (int j = 0; j < numInputs; ++j) {
+                    y += gain[i][j] * src[j];
+                }
+                dst[i] += y * level;
+            }
+        }
+
+        static Gains Convert(const Matrix &m) {
+            Gains g{};
+            for (int i = 0; i < numOutputs; ++i) {
+                for (int j = 0; j < numInputs; ++j) {
+                    g[i][j] = FromFloat<Gain>(m[i][j]);
+                }
+            }
+            return g;
+        }
+    };
+
+    //------------------------------------------------
+    // stereo field parameters for a layer, and their mapping to a gain matrix.
+    // the matrix is (balance * pan * width)
+    struct StereoField {
+        // image position in [-1, 1]; each input channel is shifted and equal-power panned
+        float pan{0.f};
+        // mid/side width in [0, 2]; 0 is mono, 1 is unchanged
+        float width{1.f};
+        // linear output channel balance in [-1, 1]
+        float balance{0.f};
+
+        typedef GainMatrix<2, 2>::Matrix Matrix;
+
+        Matrix ComputeMatrix() const {
+            // width: L' = m + ws, R' = m - ws
+            const float w = width;
+            Matrix widthMatrix{{
+                {0.5f * (1.f + w), 0.5f * (1.f - w)},
+                {0.5f * (1.f - w), 0.5f * (1.f + w)}
+            }};
+
+            // pan: left channel sits at -1, right at +1, both shifted by 2*pan and clamped
+            auto panGains = [](float pos, float &l, float &r) {
+                if (pos < -1.f) pos = -1.f;
+                if (pos > 1.f) pos = 1.f;
+                const float theta = (pos + 1.f) * 0.25f * pi<float>;
+                l = cosf(theta);
+                r = sinf(theta);
+            };
+            float ll, lr, rl, rr;
+            panGains(pan * 2.f - 1.f, ll, lr);
+            panGains(pan * 2.f + 1.f, rl, rr);
+            Matrix panMatrix{{
+                {ll, rl},
+                {lr, rr}
+            }};
+
+            // balance
+            const float balanceL = balance > 0.f ? 1.f - balance : 1.f;
+            const float balanceR = balance < 0.f ? 1.f + balance : 1.f;
+
+            Matrix m{};
+            for (int i = 0; i < 2; ++i) {
+                const float b = (i == 0) ? balanceL : balanceR;
+                for (int j = 0; j < 2; ++j) {
+                    float sum = 0.f;
+                    for (int k = 0; k < 2; ++k) {
+                        sum += panMatrix[i][k] * widthMatrix[k][j];
+                    }
+                    m[i][j] = sum * b;
+                }
+            }
+            return m;
+        }
+    };
+
+}
@@ -1,14 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <limits>
 
+#include "BehaviorScript.hpp"
+#include "LatencyProbe.hpp"
 #include "LayerBehavior.hpp"
 #include "LoopLayer.hpp"
 
 #include "Outputs.hpp"
+#include "Trace.hpp"
 #include "Types.hpp"
+#include "WorkerPool.hpp"
 
 namespace mlp {
 
@@ -23,9 +30,25 @@ namespace mlp {
         std::array<LayerBehavior, numLoopLayers> layerBehavior;
         std::array<LayerInterface, numLoopLayers> layerInterface;
 
-        // non-interleaved stereo buffers
-        typedef std::array<float, bufferFrames * numLoopLayers> LayerBuffer;
-        std::array<LayerBuffer, numLoopLayers> buffer{};
+        // interleaved stereo buffers; one per layer, plus one for the input history.
+        // buffers are traded between layers and the history when a loop is captured retroactively,
+        // so a layer's buffer is not necessarily the one with its index.
+        // samples are in the compile-time storage format (see SampleStorage.hpp)
+        typedef std::array<LoopSample, bufferFrames * numLoopChannels> LayerBuffer;
+        std::array<LayerBuffer, numLoopLayers + 1> buffer{};
+
+        //--- input history
+        // always-on ring of recent input, one full layer buffer long; position is frameCount modulo its length
+        LoopSample *historyBuffer{nullptr};
+        uint32_t historyDitherSeed{1};
+        // earliest frame that the history holds (it is restarted when its buffer is given to a layer)
+        frame_t historyStartFrame{0};
+        // first frame after the input written so far; past `frameCount` in the middle of a block
+        frame_t historyEndFrame{0};
+        // frame at which each layer's loop was last opened
+        std::array<frame_t, numLoopLayers> openFrame{};
+        // how far before the open tap a retroactively closed loop begins
+        frame_t retroPreRollFrames{0};
 
         OutputsData *outputs{};
 
@@ -33,6 +56,12 @@ namespace mlp {
         //--- other runtime state
 
         double sampleRate{48000};
+        // per-layer level smoothing time, in seconds
+        std::array<float, numLoopLayers> levelSmoothTime{};
+        static constexpr float defaultLevelSmoothTime = 0.02f;
+        // per-layer read offset smoothing time, in seconds
+        std::array<float, numLoopLayers> readOffsetSmoothTime{};
+        static constexpr float defaultReadOffsetSmoothTime = 0.1f;
         // currently-selected layer index
         unsigned int currentLayer{0};
         // the "innermost" layer will not trigger actions on layers "below" it
@@ -43,6 +72,59 @@ namespace mlp {
         // temp flag
         bool shouldAdvanceLayerOnNextTap{false};
 
+        //--- scheduled (quantized) loop open/close
+        static constexpr frame_t noEventTime = std::numeric_limits<frame_t>::max();
+        // frames processed since startup
+        frame_t frameCount{0};
+        // per-layer times at which to open/close loops
+        std::array<frame_t, numLoopLayers> pendingOpenTime{};
+        std::array<frame_t, numLoopLayers> pendingCloseTime{};
+        // true if a pending close was delayed for latency (rather than quantized)
+        std::array<bool, numLoopLayers> pendingCloseCompensated{};
+
+        //--- latency compensation
+        // audio arriving now was played this long ago
+        frame_t inputLatencyFrames{0};
+        // audio produced now is heard this much later
+        frame_t outputLatencyFrames{0};
+        // user adjustment of when a tap is taken to have happened (positive is later)
+        long int tapOffsetFrames{0};
+        LatencyProbe latencyProbe;
+        // result of the last loopback measurement (zero if none, or if it failed);
+        // the only report of a measurement, readable from any thread
+        std::atomic<frame_t> measuredLatencyFrames{0};
+        // earliest scheduled time; the block is split here, so nothing is checked per frame
+        frame_t nextEventTime{noEventTime};
+
+        //--- per-span condition events
+        // phasor results of each layer, merged over the current span
+        std::array<PhasorAdvanceResult, numLoopLayers> spanResult{};
+        struct LayerEvent {
+            unsigned int layer;
+            LayerConditionId condition;
+        };
+        // conditions raised in the current span, in resolution order
+        std::array<LayerEvent, numLoopLayers * 2> spanEvents{};
+        unsigned int numSpanEvents{0};
+
+        //--- background compression of idle layers
+        LayerCompressor<numLoopChannels, bufferFrames, LoopSample> compressor;
+
+        //--- parallel layer processing
+        // layers only interact through conditions, which are resolved between spans,
+        // so within a span each layer can run on its own thread.
+        // each writes to its own output, and outputs are summed in layer order, exactly as the serial path does
+        WorkerPool layerPool;
+        // spans with less work than this (active layers * frames) aren't worth the hand-off, and run serially
+        static constexpr unsigned int parallelMinWork = 256;
+        // parallel spans are processed in chunks of up to this many frames
+        static constexpr unsigned int layerScratchFrames = 256;
+        std::array<std::array<AudioSample, layerScratchFrames * numLoopChannels>, numLoopLayers> layerScratch{};
+
+        //--- condition/action trace
+        Trace trace;
+        bool isTracing{false};
+
         /// global interface flags (not governed by layer behaviors)
         bool clearLayerOnStop{true};
         bool clearLayerOnSet{true};
@@ -57,54 +139,244 @@ namespace mlp {
             /// the difficulty there becomes how to reclaim segmented buffer space,
             /// when layers can be stopped/cleared in any order
             for (unsigned int i = 0; i < numLoopLayers; ++i) {
-                buffer[i].fill(0.f);
-                layer[i].buffer = buffer[i].data();
+                buffer[i].fill(LoopSample{});
+                layer[i].SetBuffer(buffer[i].data());
+                compressor.SetLayer(i, &layer[i].pages);
             }
+            buffer[numLoopLayers].fill(LoopSample{});
+            historyBuffer = buffer[numLoopLayers].data();
             /// initialize interfaces
             for (unsigned int i = 0; i < numLoopLayers; ++i) {
                 layerInterface[i].SetLayer(&layer[i]);
             }
             /// initialize behaviors
             for (unsigned int i = 0; i < numLoopLayers; ++i) {
-                layerBehavior[i].thisLayer = &layerInterface[i];
-                layerBehavior[i].layerBelow = &layerInterface[(i - 1) % numLoopLayers];
-                layerBehavior[i].layerAbove = &layerInterface[(i + 1) % numLoopLayers];
+                layerBehavior[i].layerIndex = i;
+                layerBehavior[i].layers = layerInterface.data();
+                layerInterface[i].behavior = &layerBehavior[i];
             }
             /// initialize modes
             for (unsigned int i = 0; i < numLoopLayers; ++i) {
                 SetLayerBehaviorMode(layerBehavior[i], LayerBehaviorModeId::MULTIPLY_UNQUANTIZED);
             }
 
+            /// initialize parameter smoothing
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                SetLevelSmoothTime(defaultLevelSmoothTime, (int) i);
+                SetReadOffsetSmoothTime(defaultReadOffsetSmoothTime, (int) i);
+            }
+
+            pendingOpenTime.fill(noEventTime);
+            pendingCloseTime.fill(noEventTime);
+
             SetInnerLayer(0);
             SetOuterLayer(0);
+
         }
 
         void SetSampleRate(float aSampleRate) {
             sampleRate = aSampleRate;
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                layer[i].SetLevelSmoothTime(static_cast<float>(levelSmoothTime[i] * sampleRate));
+                layer[i].SetReadOffsetSmoothTime(static_cast<float>(readOffsetSmoothTime[i] * sampleRate));
+            }
         }
 
-        // process a single *stereo interleaved* audio frame
-        void ProcessFrame(const float *&src, float *&dst) {
-            float x[2];
-            float y[2]{0.f};
+        // process a block of *stereo interleaved* audio frames
+        void ProcessBlock(const AudioSample *src, AudioSample *dst, unsigned int numFrames) {
+            UpdateTracing();
+            std::chrono::steady_clock::time_point blockStartTime;
+            const frame_t blockStartFrame = frameCount;
+            if (isTracing) {
+                blockStartTime = std::chrono::steady_clock::now();
+            }
+
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                layer[i].BeginBlock(numFrames);
+            }
+            WriteHistory(src, numFrames);
+            unsigned int framesLeft = numFrames;
+            while (framesLeft > 0) {
+                // process frames up to the next scheduled event or layer condition, whichever comes first.
+                // the span ends on the frame where a condition is raised, so conditions are never checked per frame
+                unsigned int spanFrames = GetSpanFrames(framesLeft);
+                for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                    layer[i].BeginSpan(spanFrames, frameCount);
+                }
+                if (ShouldProcessSpanInParallel(spanFrames)) {
+                    ProcessSpanParallel(src, dst, spanFrames);
+                    src += spanFrames * numLoopChannels;
+                    dst += spanFrames * numLoopChannels;
+                } else {
+                    for (unsigned int i = 0; i < spanFrames; ++i) {
+                        ProcessFrame(src, dst);
+                    }
+                }
+                frameCount += spanFrames;
+                framesLeft -= spanFrames;
+                ResolveSpanConditions();
+                if (frameCount == nextEventTime) {
+                    ProcessScheduledEvents();
+                }
+            }
+
+            if (latencyProbe.IsActive()) {
+                frame_t roundTrip;
+                // the probe replaces this block's output
+                if (latencyProbe.Process(src - numFrames * numLoopChannels, dst - numFrames * numLoopChannels,
+                                         numFrames, blockStartFrame, roundTrip)) {
+                    ApplyMeasuredLatency(roundTrip);
+                }
+            }
+
+            if (isTracing) {
+                auto elapsed = std::chrono::steady_clock::now() - blockStartTime;
+                trace.Block(blockStartFrame, numFrames, static_cast<unsigned long long>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+            }
+        }
+
+        Trace &GetTrace() {
+            return trace;
+        }
+
+        LayerCompressor<numLoopChannels, bufferFrames, LoopSample> &GetCompressor() {
+            return compressor;
+        }
+
+        // process layers in parallel on the given number of workers (besides the audio thread), or serially if zero.
+        // workers are pinned to consecutive cores from `firstCore`, if it is non-negative
+        void SetLayerWorkers(unsigned int numWorkers, int firstCore = -1, int priority = 0) {
+            if (numWorkers == 0) {
+                layerPool.Stop();
+            } else {
+                layerPool.Start(numWorkers, firstCore, priority);
+            }
+        }
+
+        // copy a block of input into the history ring, in (at most) two contiguous pieces
+        void WriteHistory(const AudioSample *src, unsigned int numFrames) {
+            frame_t position = frameCount % bufferFrames;
+            frame_t firstFrames = std::min<frame_t>(numFrames, bufferFrames - position);
+            StoreSamples(src, firstFrames * numLoopChannels, historyBuffer + position * numLoopChannels);
+            StoreSamples(src + firstFrames * numLoopChannels, (numFrames - firstFrames) * numLoopChannels,
+                         historyBuffer);
+            historyEndFrame = frameCount + numFrames;
+        }
+
+        void StoreSamples(const AudioSample *src, frame_t numSamples, LoopSample *dst) {
+            for (frame_t i = 0; i < numSamples; ++i) {
+                LoopFormat::Store<LoopStorage>(dst[i], src[i], historyDitherSeed);
+            }
+        }
+
+        // follow the trace's enabled flag; called at the start of each block
+        void UpdateTracing() {
+            bool shouldTrace = trace.IsEnabled();
+            if (shouldTrace == isTracing) {
+                return;
+            }
+            isTracing = shouldTrace;
+            for (auto &behavior: layerBehavior) {
+                behavior.trace = isTracing ? &trace : nullptr;
+            }
+        }
+
+        // process a single *stereo interleaved* audio frame.
+        // layer results are only collected here; conditions are resolved at the end of the span
+        void ProcessFrame(const AudioSample *&src, AudioSample *&dst) {
+            AudioSample x[2];
+            AudioSample y[2]{};
             x[0] = *src++;
             x[1] = *src++;
             for (unsigned int i = 0; i < numLoopLayers; ++i) {
-                auto phaseUpdateResult = layer[i].ProcessFrame(x, y);
-                if (phaseUpdateResult.Test(PhasorAdvanceResultFlag::WRAPPED_LOOP)) {
-                    layerBehavior[i].ProcessCondition(LayerConditionId::Wrap);
+                spanResult[i].Merge(layer[i].ProcessFrame(x, y));
+            }
+            *dst++ = y[0];
+            *dst++ = y[1];
+        }
+
+        // cost model for parallel spans: there must be workers, at least two layers running,
+        // and enough work to pay for waking the workers
+        bool ShouldProcessSpanInParallel(unsigned int spanFrames) const {
+            if (layerPool.GetNumWorkers() == 0) {
+                return false;
+            }
+            unsigned int numActive = 0;
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                if (layer[i].state != LoopLayerState::STOPPED) {
+                    numActive++;
+                }
+            }
+            return numActive >= 2 && numActive * spanFrames >= parallelMinWork;
+        }
+
+        // process a span with each layer on the worker pool, then sum the layer outputs.
+        // the result is bit-identical to processing the span frame by frame
+        void ProcessSpanParallel(const AudioSample *src, AudioSample *dst, unsigned int spanFrames) {
+            for (unsigned int offset = 0; offset < spanFrames; offset += layerScratchFrames) {
+                const unsigned int numFrames = std::min(spanFrames - offset, layerScratchFrames);
+                const AudioSample *chunkSrc = src + offset * numLoopChannels;
+                auto processLayer = [&](unsigned int i) {
+                    AudioSample *out = layerScratch[i].data();
+                    std::fill(out, out + numFrames * numLoopChannels, AudioSample{});
+                    for (unsigned int f = 0; f < numFrames; ++f) {
+                        spanResult[i].Merge(layer[i].ProcessFrame(chunkSrc + f * numLoopChannels,
+                                                                  out + f * numLoopChannels));
+                    }
+                };
+                layerPool.Run(numLoopLayers, processLayer);
+                AudioSample *chunkDst = dst + offset * numLoopChannels;
+                for (unsigned int f = 0; f < numFrames * numLoopChannels; ++f) {
+                    AudioSample y{};
+                    for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                        y += layerScratch[i][f];
+                    }
+                    chunkDst[f] = y;
+                }
+            }
+        }
+
+        // length of the next span: up to the next scheduled event, or the next condition on any layer
+        unsigned int GetSpanFrames(unsigned int framesLeft) const {
+            frame_t spanFrames = framesLeft;
+            if (nextEventTime - frameCount < spanFrames) {
+                spanFrames = nextEventTime - frameCount;
+            }
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                frame_t frames = layer[i].GetFramesUntilCondition();
+                if (frames > 0 && frames < spanFrames) {
+                    spanFrames = frames;
+                }
+            }
+            return static_cast<unsigned int>(spanFrames);
+        }
+
+        // gather the conditions raised during the last span, then perform their actions.
+        // conditions are resolved in ascending layer order, with a layer's wrap before its trigger.
+        // every layer has finished the span before any action is taken,
+        // so the result doesn't depend on which layer raised a condition first, or on the block size
+        void ResolveSpanConditions() {
+            numSpanEvents = 0;
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                auto &result = spanResult[i];
+                if (result.Test(PhasorAdvanceResultFlag::WRAPPED_LOOP)) {
+                    spanEvents[numSpanEvents++] = {i, LayerConditionId::Wrap};
                     SetOutputLayerFlag(i, LayerOutputFlagId::Wrapped);
                 }
-                if (phaseUpdateResult.Test(PhasorAdvanceResultFlag::CROSSED_TRIGGER)) {
-                    layerBehavior[i].ProcessCondition(LayerConditionId::Trigger);
+                if (result.Test(PhasorAdvanceResultFlag::CROSSED_TRIGGER)) {
+                    spanEvents[numSpanEvents++] = {i, LayerConditionId::Trigger};
                     SetOutputLayerFlag(i, LayerOutputFlagId::Triggered);
                 }
-                if (phaseUpdateResult.Test(PhasorAdvanceResultFlag::DONE_FADEOUT)) {
+                if (result.Test(PhasorAdvanceResultFlag::DONE_FADEOUT)) {
                     SetOutputLayerFlag(i, LayerOutputFlagId::Silent);
                 }
+                result = PhasorAdvanceResult{};
+            }
+            // (called after the span, so the conditions fired on its last frame)
+            for (unsigned int e = 0; e < numSpanEvents; ++e) {
+                layerBehavior[spanEvents[e].layer].ProcessCondition(spanEvents[e].condition, frameCount - 1);
             }
-            *dst++ = y[0];
-            *dst++ = y[1];
         }
 
         void SetOutputLayerFlag(unsigned int layerIndex, LayerOutputFlagId flag) {
@@ -157,10 +429,127 @@ namespace mlp {
             SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Outer);
         }
 
+        //------------------------------------------------
+        //-- scheduling
+
+        // index of the layer whose boundaries quantize the given layer, or -1 if there is none
+        int GetQuantizeLeader(unsigned int layerIndex) const {
+            if (layerInterface[layerIndex].isInner) {
+                return -1;
+            }
+            return static_cast<int>((layerIndex + numLoopLayers - 1) % numLoopLayers);
+        }
+
+        // frames until the next loop boundary of the leader, or zero if there is no boundary to wait for
+        frame_t GetFramesUntilLeaderBoundary(unsigned int layerIndex) const {
+            int leader = GetQuantizeLeader(layerIndex);
+            if (leader < 0) {
+                return 0;
+            }
+            return layer[leader].GetFramesUntilWrap();
+        }
+
+        // frames to keep recording, so that the loop length is a whole multiple of the leader's length
+        frame_t GetFramesUntilQuantizedClose(unsigned int layerIndex) const {
+            int leader = GetQuantizeLeader(layerIndex);
+            if (leader < 0 || layer[leader].GetFramesUntilWrap() == 0) {
+                return 0;
+            }
+            const frame_t leaderFrames = layer[leader].GetLoopFrames();
+            if (leaderFrames == 0) {
+                return 0;
+            }
+            const frame_t recordedFrames = layer[layerIndex].GetCurrentFrame() - layer[layerIndex].loopStartFrame;
+            const frame_t multiple = recordedFrames == 0 ? 1 : (recordedFrames + leaderFrames - 1) / leaderFrames;
+            return multiple * leaderFrames - recordedFrames;
+        }
+
+        void UpdateNextEventTime() {
+            nextEventTime = noEventTime;
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                nextEventTime = std::min(nextEventTime, std::min(pendingOpenTime[i], pendingCloseTime[i]));
+            }
+        }
+
+        void ProcessScheduledEvents() {
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                if (pendingOpenTime[i] == frameCount) {
+                    pendingOpenTime[i] = noEventTime;
+                    OpenLayerLoop(i);
+                }
+                if (pendingCloseTime[i] == frameCount) {
+                    pendingCloseTime[i] = noEventTime;
+                    CloseLayerLoop(i, pendingCloseCompensated[i]);
+                }
+            }
+            UpdateNextEventTime();
+        }
+
+        void OpenLayerLoop(unsigned int layerIndex) {
+            std::cout << "TapLoop(): opening loop; layer = " << layerIndex << std::endl;
+            openFrame[layerIndex] = frameCount;
+            layer[layerIndex].OpenLoop();
+            SetOutputLayerFlag(layerIndex, LayerOutputFlagId::Writing);
+            SetOutputLayerFlag(layerIndex, LayerOutputFlagId::Opened);
+            layerBehavior[layerIndex].ProcessCondition(LayerConditionId::OpenLoop, frameCount);
+            if (clearLayerOnSet) {
+                layer[layerIndex].SetClear(true);
+                SetOutputLayerFlag(layerIndex, LayerOutputFlagId::Clearing);
+            }
+        }
+
+        // compensated: the close was delayed by the input latency,
+        // so start playback far enough into the loop that it is heard in time with the tap
+        void CloseLayerLoop(unsigned int layerIndex, bool compensated = false) {
+            std::cout << "TapLoop(): closing loop; layer = " << layerIndex << std::endl;
+            layer[layerIndex].CloseLoop(true, false,
+                                        compensated ? inputLatencyFrames + outputLatencyFrames : 0);
+            FinishCloseLayerLoop(layerIndex);
+        }
+
+        // make a closed loop on a layer from input history between the given frames.
+        // the history buffer is handed to the layer, and the layer's buffer becomes the new history,
+        // so nothing is copied. returns false if the history doesn't cover any of the range
+        bool CaptureLayerLoop(unsigned int layerIndex, frame_t startFrame, frame_t endFrame) {
+            if (startFrame < historyStartFrame) {
+                startFrame = historyStartFrame;
+            }
+            if (endFrame > frameCount) {
+                endFrame = frameCount;
+            }
+            if (endFrame - startFrame >= bufferFrames) {
+                startFrame = endFrame - (bufferFrames - 1);
+            }
+            if (endFrame <= startFrame) {
+                return false;
+            }
+            pendingCloseTime[layerIndex] = noEventTime;
+            pendingOpenTime[layerIndex] = noEventTime;
+            UpdateNextEventTime();
+            const frame_t start = startFrame % bufferFrames;
+            historyBuffer = layer[layerIndex].AdoptLoop(historyBuffer, start, start + (endFrame - startFrame));
+            // the rest of this block's input went into the buffer just given away
+            historyStartFrame = historyEndFrame;
+            FinishCloseLayerLoop(layerIndex);
+            return true;
+        }
+
+        void FinishCloseLayerLoop(unsigned int layerIndex) {
+            layerBehavior[layerIndex].ProcessCondition(LayerConditionId::CloseLoop, frameCount);
+            if (advanceLayerOnLoopOpen) {
+                shouldAdvanceLayerOnNextTap = true;
+            }
+            SetOuterLayer(layerIndex);
+            SetOutputLayerFlag(layerIndex, LayerOutputFlagId::Closed);
+            SetOutputLayerFlag(layerIndex, LayerOutputFlagId::NotWriting);
+            SetOutputLayerFlag(layerIndex, LayerOutputFlagId::Reading);
+        }
+
         //------------------------------------------------
         //-- control
 
         // first action: opens/closes the loop, advances the layer
+        // in quantized modes, the open/close is scheduled for the leader's next loop boundary
         void SetLoopTap() {
             switch (layer[currentLayer].state) {
                 case LoopLayerState::STOPPED:
@@ -178,33 +567,136 @@ namespace mlp {
                         return;
                     }
 
-                    std::cout << "TapLoop(): opening loop; layer = " << currentLayer << std::endl;
-                    layer[currentLayer].OpenLoop();
-                    SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Writing);
-                    SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Opened);
-                    layerBehavior[currentLayer].ProcessCondition(LayerConditionId::OpenLoop);
-                    if (clearLayerOnSet) {
-                        layer[currentLayer].SetClear(true);
-                        SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Clearing);
+                    if (pendingOpenTime[currentLayer] != noEventTime) {
+                        // tapping again while waiting for the boundary cancels the open
+                        std::cout << "TapLoop(): cancelling scheduled open; layer = " << currentLayer << std::endl;
+                        pendingOpenTime[currentLayer] = noEventTime;
+                        UpdateNextEventTime();
+                        return;
+                    }
+                    {
+                        frame_t wait = 0;
+                        if (layerBehavior[currentLayer].quantizeOpen) {
+                            wait = GetFramesUntilLeaderBoundary(currentLayer);
+                        }
+                        if (wait == 0) {
+                            // unquantized: wait for the audio played at the tap to arrive
+                            wait = GetTapDelay();
+                        }
+                        if (wait > 0) {
+                            pendingOpenTime[currentLayer] = frameCount + wait;
+                            UpdateNextEventTime();
+                            shouldAdvanceLayerOnNextTap = false;
+                            break;
+                        }
                     }
+                    OpenLayerLoop(currentLayer);
                     shouldAdvanceLayerOnNextTap = false;
                     break;
 
                 case LoopLayerState::SETTING:
-                    std::cout << "TapLoop(): closing loop; layer = " << currentLayer << std::endl;
-                    layer[currentLayer].CloseLoop(true, false);
-                    layerBehavior[currentLayer].ProcessCondition(LayerConditionId::CloseLoop);
-                    if (advanceLayerOnLoopOpen) {
-                        shouldAdvanceLayerOnNextTap = true;
+                    if (pendingCloseTime[currentLayer] != noEventTime) {
+                        // already waiting for the boundary
+                        return;
                     }
-                    SetOuterLayer(currentLayer);
-                    SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Closed);
-                    SetOutputLayerFlag(currentLayer, LayerOutputFlagId::NotWriting);
-                    SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Reading);
+                    {
+                        frame_t wait = 0;
+                        if (layerBehavior[currentLayer].quantizeClose) {
+                            wait = GetFramesUntilQuantizedClose(currentLayer);
+                        }
+                        pendingCloseCompensated[currentLayer] = (wait == 0);
+                        if (wait == 0) {
+                            wait = GetTapDelay();
+                        }
+                        if (wait > 0) {
+                            pendingCloseTime[currentLayer] = frameCount + wait;
+                            UpdateNextEventTime();
+                            break;
+                        }
+                    }
+                    CloseLayerLoop(currentLayer, true);
                     break;
             }
         }
 
+        //------------------------------------------------
+        //-- latency compensation
+
+        // frames between a tap arriving, and the input which was played at the same moment
+        frame_t GetTapDelay() const {
+            long int delay = static_cast<long int>(inputLatencyFrames) + tapOffsetFrames;
+            return delay > 0 ? static_cast<frame_t>(delay) : 0;
+        }
+
+        void SetInputLatency(frame_t frames) {
+            inputLatencyFrames = frames;
+        }
+
+        void SetOutputLatency(frame_t frames) {
+            outputLatencyFrames = frames;
+        }
+
+        void SetTapOffset(long int frames) {
+            tapOffsetFrames = frames;
+        }
+
+        void SetTapOffsetTime(double aSeconds) {
+            SetTapOffset(static_cast<long int>(aSeconds * sampleRate));
+        }
+
+        // start measuring round-trip latency; output is replaced by test clicks until it finishes
+        void StartLatencyMeasurement() {
+            measuredLatencyFrames = 0;
+            latencyProbe.Start(frameCount, sampleRate);
+        }
+
+        frame_t GetMeasuredLatency() const {
+            return measuredLatencyFrames;
+        }
+
+        // use a measured round trip as the device latency,
+        // keeping the previous input/output split if there was one, or halving it otherwise
+        void ApplyMeasuredLatency(frame_t roundTrip) {
+            if (roundTrip == 0) {
+                return;
+            }
+            const frame_t previous = inputLatencyFrames + outputLatencyFrames;
+            if (previous > 0) {
+                inputLatencyFrames = static_cast<frame_t>(
+                        static_cast<double>(roundTrip) * static_cast<double>(inputLatencyFrames) / previous);
+            } else {
+                inputLatencyFrames = roundTrip / 2;
+            }
+            outputLatencyFrames = roundTrip - inputLatencyFrames;
+            measuredLatencyFrames = roundTrip;
+        }
+
+        // close the current layer's loop as if it had been opened earlier, by the pre-roll time.
+        // the loop is taken from the input history, and what the layer recorded itself is discarded
+        void RetroCloseLoopTap() {
+            if (layer[currentLayer].state != LoopLayerState::SETTING) {
+                return;
+            }
+            const frame_t open = openFrame[currentLayer];
+            const frame_t start = open > retroPreRollFrames ? open - retroPreRollFrames : 0;
+            CaptureLayerLoop(currentLayer, start, frameCount);
+        }
+
+        // capture the last given number of frames of input as a loop, on the layer the next tap would open
+        void CaptureLoop(frame_t frames) {
+            if (layer[currentLayer].state != LoopLayerState::SETTING
+                && advanceLayerOnLoopOpen && shouldAdvanceLayerOnNextTap) {
+                SetCurrentLayer(currentLayer >= (numLoopLayers - 1) ? 0 : currentLayer + 1);
+                shouldAdvanceLayerOnNextTap = false;
+            }
+            const frame_t start = frameCount > frames ? frameCount - frames : 0;
+            CaptureLayerLoop(currentLayer, start, frameCount);
+        }
+
+        void SetRetroPreRoll(frame_t frames) {
+            retroPreRollFrames = frames;
+        }
+
         void ToggleOverdub() {
             if (currentLayer >= 0 && currentLayer < numLoopLayers)
                 layer[currentLayer].ToggleWrite();
@@ -246,6 +738,9 @@ namespace mlp {
             assert(currentLayer >= 0 && currentLayer < numLoopLayers);
             // std::cout << "(stopping current layer)" << std::endl;
             layer[currentLayer].Stop();
+            pendingOpenTime[currentLayer] = noEventTime;
+            pendingCloseTime[currentLayer] = noEventTime;
+            UpdateNextEventTime();
             SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Stopped);
             if (clearLayerOnStop) {
                 //layer[currentLayer].preserveLevel = 0.f;
@@ -276,22 +771,67 @@ namespace mlp {
 
         void SetPreserveLevel(float level, int aLayerIndex = -1) {
             unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
-            layer[layerIndex].preserveLevel = level;
+            layer[layerIndex].preserveLevel.SetTarget(level);
         }
 
         void SetRecordLevel(float level, int aLayerIndex = -1) {
             unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
-            layer[layerIndex].recordLevel = level;
+            layer[layerIndex].recordLevel.SetTarget(level);
         }
 
         void SetPlaybackLevel(float level, int aLayerIndex = -1) {
             unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
-            layer[layerIndex].playbackLevel = level;
+            layer[layerIndex].playbackLevel.SetTarget(level);
+        }
+
+        void SetLevelSmoothTime(float aSeconds, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            levelSmoothTime[layerIndex] = aSeconds;
+            layer[layerIndex].SetLevelSmoothTime(static_cast<float>(aSeconds * sampleRate));
+        }
+
+        void SetLevelSmoothMode(SmoothParamMode mode, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            layer[layerIndex].SetLevelSmoothMode(mode);
+        }
+
+        // set the read head delay, in frames
+        void SetReadOffsetFrames(float frames, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            layer[layerIndex].SetReadOffset(frames);
+        }
+
+        // set the read head delay, in seconds
+        void SetReadOffsetTime(float aSeconds, int aLayerIndex = -1) {
+            SetReadOffsetFrames(static_cast<float>(aSeconds * sampleRate), aLayerIndex);
+        }
+
+        void SetReadOffsetSmoothTime(float aSeconds, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            readOffsetSmoothTime[layerIndex] = aSeconds;
+            layer[layerIndex].SetReadOffsetSmoothTime(static_cast<float>(aSeconds * sampleRate));
+        }
+
+        void SetPan(float pan, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            layer[layerIndex].SetPan(pan);
+        }
+
+        void SetWidth(float width, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            layer[layerIndex].SetWidth(width);
+        }
+
+        void SetBalance(float balance, int aLayerIndex = -1) {
+            unsigned int layerIndex = aLayerIndex < 0 ? currentLayer : (unsigned int) aLayerIndex;
+            layer[layerIndex].SetBalance(balance);
         }
 
         void SetCurrentLayer(unsigned int layerIndex) {
-            currentLayer = layerIndex;
-            SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Selected);
+            if (layerIndex < numLoopLayers) {
+                currentLayer = layerIndex;
+                SetOutputLayerFlag(currentLayer, LayerOutputFlagId::Selected);
+            }
         }
 
         void SetLoopStartFrame(frame_t frame, int aLayerIndex = -1) {
@@ -395,6 +935,35 @@ namespace mlp {
             }
         }
 
+        // route an action on a condition of one layer to an arbitrary set of layers (empty set removes the route)
+        void SetLayerActionTargets(unsigned int aLayerIndex, LayerConditionId condition, LayerActionId action,
+                                   LayerMask targets) {
+            if (aLayerIndex >= numLoopLayers
+                || condition >= LayerConditionId::NUM_CONDITIONS
+                || action >= LayerActionId::NUM_ACTIONS) {
+                return;
+            }
+            layerBehavior[aLayerIndex].SetActionTargets(condition, action, targets);
+        }
+
+        // replace all layer behaviors with a compiled program
+        void LoadBehavior(const BehaviorProgram &program) {
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                layerBehavior[i].CopyTables(program.layer[i]);
+            }
+        }
+
+        // limit how many times an action on a condition fires before it is rearmed (negative is unlimited)
+        void SetLayerActionCount(unsigned int aLayerIndex, LayerConditionId condition, LayerActionId action,
+                                 int count) {
+            if (aLayerIndex >= numLoopLayers
+                || condition >= LayerConditionId::NUM_CONDITIONS
+                || action >= LayerActionId::NUM_ACTIONS) {
+                return;
+            }
+            layerBehavior[aLayerIndex].SetActionCount(condition, action, count);
+        }
+
 
         frame_t GetLoopEndFrame(unsigned int aLayerIndex) const {
             return layer[aLayerIndex].loopEndFrame;
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+
+#include "Constants.hpp"
+#include "SampleFormat.hpp"
+#include "Types.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // measures round-trip audio latency with a physical (or virtual) loopback from output to input.
+    // sends a few short clicks, and times how long each one takes to arrive at the input.
+    // while measuring, the processor's own output is muted, so that loops can't be mistaken for clicks
+    struct LatencyProbe {
+        static constexpr unsigned int numPings = 3;
+        static constexpr unsigned int clickFrames = 4;
+        static constexpr float clickLevel = 0.5f;
+        // input level that counts as an arriving click
+        static constexpr float threshold = 0.25f;
+        static inline const AudioSample click = FromFloat<AudioSample>(clickLevel);
+        static inline const AudioSample clickThreshold = FromFloat<AudioSample>(threshold);
+
+        enum class State {
+            Idle,
+            // waiting to send the next click
+            Waiting,
+            // click sent, waiting for it to arrive
+            Listening,
+        };
+
+        State state{State::Idle};
+        // time between clicks, and how long to wait for one to arrive, in frames
+        frame_t interval{0};
+        frame_t timeout{0};
+        frame_t nextPingTime{0};
+        frame_t sendTime{0};
+        unsigned int clickFramesLeft{0};
+        unsigned int pingIndex{0};
+        std::array<frame_t, numPings> roundTrip{};
+
+        void Start(frame_t now, double sampleRate) {
+            interval = static_cast<frame_t>(sampleRate * 0.25);
+            timeout = static_cast<frame_t>(sampleRate);
+            nextPingTime = now;
+            pingIndex = 0;
+            clickFramesLeft = 0;
+            state = State::Waiting;
+        }
+
+        bool IsActive() const {
+            return state != State::Idle;
+        }
+
+        // process a block of interleaved stereo frames, starting at the given time.
+        // returns true when the measurement has finished; `result` is then the median round trip in frames,
+        // or zero if a click never arrived
+        bool Process(const AudioSample *src, AudioSample *dst, unsigned int numFrames, frame_t blockStartTime,
+                     frame_t &result) {
+            for (unsigned int i = 0; i < numFrames; ++i) {
+                const frame_t now = blockStartTime + i;
+                AudioSample y{};
+                if (state == State::Waiting && now >= nextPingTime) {
+                    sendTime = now;
+                    clickFramesLeft = clickFrames;
+                    state = State::Listening;
+                }
+                if (clickFramesLeft > 0) {
+                    y = click;
+                    clickFramesLeft--;
+                }
+                const AudioSample *frameIn = src + i * numLoopChannels;
+                AudioSample *frameOut = dst + i * numLoopChannels;
+                bool isClickHeard = false;
+                for (unsigned int ch = 0; ch < numLoopChannels; ++ch) {
+                    frameOut[ch] = y;
+                    isClickHeard |= LoopFormat::Magnitude(frameIn[ch]) > clickThreshold;
+                }
+
+                if (state != State::Listening || now <= sendTime) {
+                    continue;
+                }
+                if (isClickHeard) {
+                    roundTrip[pingIndex++] = now - sendTime;
+                    if (pingIndex == numPings) {
+                        std::sort(roundTrip.begin(), roundTrip.end());
+                        result = roundTrip[numPings / 2];
+                        state = State::Idle;
+                        return true;
+                    }
+                    // let the click die away before sending another
+                    nextPingTime = now + interval;
+                    state = State::Waiting;
+                } else if (now - sendTime > timeout) {
+                    result = 0;
+                    state = State::Idle;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+}
@@ -1,13 +1,11 @@
 #pragma once
 
 #include <array>
-#include <array>
-#include <functional>
-#include <utility>
 
 #include "Constants.hpp"
 #include "LoopLayer.hpp"
 #include "Outputs.hpp"
+#include "Trace.hpp"
 #include "Types.hpp"
 
 namespace mlp {
@@ -21,9 +19,23 @@ namespace mlp {
         StoreReset,
         EnableLoop,
         DisableLoop,
+        // restore the counters of all the target layer's bindings
+        RearmCounters,
         NUM_ACTIONS
     };
 
+    static constexpr char LayerActionIdLabel[static_cast<int>(LayerActionId::NUM_ACTIONS)][16] = {
+        "RESET",
+        "RESTART",
+        "PAUSE",
+        "RESUME",
+        "STORE_TRIGGER",
+        "STORE_RESET",
+        "ENABLE_LOOP",
+        "DISABLE_LOOP",
+        "REARM",
+    };
+
     enum class LayerConditionId {
         OpenLoop,
         CloseLoop,
@@ -32,128 +44,323 @@ namespace mlp {
         NUM_CONDITIONS
     };
 
-    struct LayerInterface {
-        std::array<int, static_cast<size_t>(LayerConditionId::NUM_CONDITIONS)> conditionCounter{-1};
+    static constexpr char LayerConditionIdLabel[static_cast<int>(LayerConditionId::NUM_CONDITIONS)][16] = {
+        "OPEN",
+        "CLOSE",
+        "TRIGGER",
+        "WRAP",
+    };
 
-        std::array<std::function<void()>, static_cast<size_t>(LayerActionId::NUM_ACTIONS)> actions;
+    // set of layers, one bit per layer index
+    typedef unsigned int LayerMask;
+    static_assert(numLoopLayers <= sizeof(LayerMask) * 8, "too many layers for layer mask");
+    static constexpr LayerMask allLayersMask = (numLoopLayers >= sizeof(LayerMask) * 8)
+            ? ~0u : (1u << numLoopLayers) - 1u;
 
-        bool isInner;
-        bool isOuter;
+    struct LayerBehavior;
+
+    struct LayerInterface {
+        LoopLayer<numLoopChannels, bufferFrames> *layer{nullptr};
+        LayerBehavior *behavior{nullptr};
+
+        bool isInner{false};
+        bool isOuter{false};
 
         LayerOutputs *outputs{nullptr};
 
-        void SetLayer(LoopLayer<numLoopChannels, bufferFrames> *layer) {
-            actions[static_cast<size_t>(LayerActionId::Reset)] = [layer]() { layer->Reset(); };
-            actions[static_cast<size_t>(LayerActionId::Restart)] = [layer]() { layer->Restart(); };
-            actions[static_cast<size_t>(LayerActionId::Pause)] = [layer]() { layer->Pause(); };
-            actions[static_cast<size_t>(LayerActionId::Resume)] = [layer]() { layer->Resume(); };
-            actions[static_cast<size_t>(LayerActionId::StoreTrigger)] = [layer]() { layer->StoreTrigger(); };
-            actions[static_cast<size_t>(LayerActionId::StoreReset)] = [layer]() { layer->StoreReset(); };
-            actions[static_cast<size_t>(LayerActionId::EnableLoop)] = [layer]() { layer->SetLoopEnabled(true); };
-            actions[static_cast<size_t>(LayerActionId::DisableLoop)] = [layer]() { layer->SetLoopEnabled(false); };
+        void SetLayer(LoopLayer<numLoopChannels, bufferFrames> *aLayer) {
+            layer = aLayer;
         }
 
-        void DoAction(LayerActionId id) {
-            actions[static_cast<size_t>(id)]();
-            if (outputs) {
-                switch (id) {
-                    case LayerActionId::Reset:
-                        outputs->flags.Set(LayerOutputFlagId::Reset);// ->SetLayerFlag(index, LayerOutputFlagId::Reset);
-                        break;
-                    case LayerActionId::Pause:
-                        outputs->flags.Set(LayerOutputFlagId::Paused);
-                        break;
-                    case LayerActionId::Resume:
-                        outputs->flags.Set(LayerOutputFlagId::Resumed);
-                        break;
-                    case LayerActionId::StoreTrigger:
-                        outputs->flags.Set(LayerOutputFlagId::Triggered);
-                        break;
-                    case LayerActionId::StoreReset:
-                        outputs->flags.Set(LayerOutputFlagId::Reset);
-                        break;
-                    case LayerActionId::Restart:
-                        outputs->flags.Set(LayerOutputFlagId::Restarted);
-                        break;
-                    case LayerActionId::EnableLoop:
-                        outputs->flags.Set(LayerOutputFlagId::Opened);
-                        break;
-                    case LayerActionId::DisableLoop:
-                        outputs->flags.Set(LayerOutputFlagId::Closed);
-                        break;
-                    case LayerActionId::NUM_ACTIONS:
-                    default:
-                        break;
-                }
-            }
-        }
+        void DoAction(LayerActionId id);
+    };
+
+    // condition on the source layer's role, checked when a binding fires
+    enum class LayerActionGuard {
+        Always,
+        // skip if the source layer is the innermost layer
+        NotInner,
+        // skip if the source layer is the outermost layer
+        NotOuter,
+    };
+
+    // one entry in a condition's action table: perform an action on each layer in a set
+    struct LayerActionBinding {
+        LayerActionId action{LayerActionId::NUM_ACTIONS};
+        LayerMask targets{0};
+        LayerActionGuard guard{LayerActionGuard::Always};
+        // number of times the binding fires before it must be rearmed; negative is unlimited
+        int count{-1};
+        // firings left until rearmed
+        int remaining{-1};
     };
 
-    typedef std::function<void(
-            LayerInterface *, // this layer
-            LayerInterface *, // layer below
-            LayerInterface * // layer above
-    )> LayerActionFunction;
+    static constexpr unsigned int maxBindingsPerCondition = 8;
+    static_assert(maxBindingsPerCondition <= sizeof(unsigned int) * 8, "too many bindings for armed mask");
 
-    // defines the conditions->actions mapping for a given layer
+    // defines the conditions->actions mapping for a given layer.
+    // each condition has a short, ordered table of bindings;
+    // bindings are performed in order, and each binding's targets in ascending layer order
     struct LayerBehavior {
-        std::array<LayerActionFunction, static_cast<size_t>(LayerConditionId::NUM_CONDITIONS)> conditionAction;
-        LayerInterface *thisLayer{};
-        LayerInterface *layerBelow{};
-        LayerInterface *layerAbove{};
+        typedef std::array<LayerActionBinding, maxBindingsPerCondition> BindingTable;
+        std::array<BindingTable, static_cast<size_t>(LayerConditionId::NUM_CONDITIONS)> bindings{};
+        std::array<unsigned int, static_cast<size_t>(LayerConditionId::NUM_CONDITIONS)> numBindings{};
+        // per condition, one bit for each binding whose counter has not run down.
+        // counters are only touched when set, rearmed, or when a counted binding fires
+        std::array<unsigned int, static_cast<size_t>(LayerConditionId::NUM_CONDITIONS)> armedMask{};
+
+        // index of this layer, and the interfaces of all layers (indexed by target bits)
+        unsigned int layerIndex{0};
+        LayerInterface *layers{nullptr};
+        // if set, fired conditions and performed actions are recorded here
+        Trace *trace{nullptr};
+
+        // when set, opening/closing a loop on this layer is deferred to the next loop boundary of the layer below,
+        // so that the loop starts on a boundary / has a length which is a multiple of the lower layer's length
+        bool quantizeOpen{false};
+        bool quantizeClose{false};
+
+        LayerMask SelfMask() const {
+            return 1u << layerIndex;
+        }
+
+        LayerMask BelowMask() const {
+            return 1u << ((layerIndex + numLoopLayers - 1) % numLoopLayers);
+        }
+
+        LayerMask AboveMask() const {
+            return 1u << ((layerIndex + 1) % numLoopLayers);
+        }
 
         void Clear() {
-            for (auto &action: conditionAction) {
-                action = [](LayerInterface *aThisLayer, LayerInterface *aLayerBelow, LayerInterface *aLayerAbove) {
-                    (void) aThisLayer;
-                    (void) aLayerBelow;
-                    (void) aLayerAbove;
-                };
+            quantizeOpen = false;
+            quantizeClose = false;
+            numBindings.fill(0);
+            armedMask.fill(0);
+        }
+
+        // append a binding to the condition's table; returns false if the table is full
+        bool AddAction(LayerConditionId id, LayerActionId action, LayerMask targets,
+                       LayerActionGuard guard = LayerActionGuard::Always, int count = -1) {
+            auto c = static_cast<size_t>(id);
+            if (numBindings[c] >= maxBindingsPerCondition) {
+                return false;
             }
-            for (auto &counter: thisLayer->conditionCounter) {
-                counter = -1;
+            if (count != 0) {
+                armedMask[c] |= 1u << numBindings[c];
             }
+            bindings[c][numBindings[c]++] = {action, targets & allLayersMask, guard, count, count};
+            return true;
         }
 
-        void ProcessCondition(LayerConditionId id) {
-            int &counter = thisLayer->conditionCounter[static_cast<size_t>(id)];
-            if (counter == 0) {
-                // no actions taken if the counter has run down
-                return;
+        // take the binding tables and quantize flags of another behavior (e.g. one compiled from a script).
+        // this is a fixed-size copy, and safe to call from the audio thread
+        void CopyTables(const LayerBehavior &other) {
+            bindings = other.bindings;
+            numBindings = other.numBindings;
+            armedMask = other.armedMask;
+            quantizeOpen = other.quantizeOpen;
+            quantizeClose = other.quantizeClose;
+        }
+
+        // replace the target set of the first binding of an action to a condition.
+        // an empty set removes the binding; if there is no such binding, one is appended
+        bool SetActionTargets(LayerConditionId id, LayerActionId action, LayerMask targets) {
+            auto c = static_cast<size_t>(id);
+            targets &= allLayersMask;
+            for (unsigned int i = 0; i < numBindings[c]; ++i) {
+                if (bindings[c][i].action != action) {
+                    continue;
+                }
+                if (targets != 0) {
+                    bindings[c][i].targets = targets;
+                } else {
+                    for (unsigned int j = i + 1; j < numBindings[c]; ++j) {
+                        bindings[c][j - 1] = bindings[c][j];
+                    }
+                    numBindings[c]--;
+                    UpdateArmedMask(c);
+                }
+                return true;
+            }
+            if (targets == 0) {
+                return true;
+            }
+            return AddAction(id, action, targets);
+        }
+
+        // set the count of the first binding of an action to a condition, and rearm it.
+        // returns false if there is no such binding
+        bool SetActionCount(LayerConditionId id, LayerActionId action, int count) {
+            auto c = static_cast<size_t>(id);
+            for (unsigned int i = 0; i < numBindings[c]; ++i) {
+                if (bindings[c][i].action == action) {
+                    bindings[c][i].count = count;
+                    bindings[c][i].remaining = count;
+                    UpdateArmedMask(c);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // restore every binding's counter
+        void RearmCounters() {
+            for (size_t c = 0; c < bindings.size(); ++c) {
+                for (unsigned int i = 0; i < numBindings[c]; ++i) {
+                    bindings[c][i].remaining = bindings[c][i].count;
+                }
+                UpdateArmedMask(c);
             }
-            if (counter > 0) {
+        }
+
+        // `time` is the frame on which the condition fired (for tracing)
+        void ProcessCondition(LayerConditionId id, frame_t time) {
+            const LayerInterface &thisLayer = layers[layerIndex];
+            auto c = static_cast<size_t>(id);
+            if (trace) {
+                trace->Condition(time, layerIndex, static_cast<unsigned int>(c), thisLayer.layer->currentPhasorIndex);
+            }
+            // bindings which have run down are skipped without being visited
+            unsigned int armed = armedMask[c];
+            while (armed != 0) {
+                const unsigned int i = LowestSetBit(armed);
+                armed &= armed - 1;
+                LayerActionBinding &binding = bindings[c][i];
+                if ((binding.guard == LayerActionGuard::NotInner && thisLayer.isInner)
+                    || (binding.guard == LayerActionGuard::NotOuter && thisLayer.isOuter)) {
+                    continue;
+                }
                 // decrement if it's positive; negative counter is ignored
-                counter--;
+                if (binding.remaining > 0 && --binding.remaining == 0) {
+                    armedMask[c] &= ~(1u << i);
+                }
+                LayerMask targets = binding.targets;
+                while (targets != 0) {
+                    const unsigned int target = LowestSetBit(targets);
+                    if (trace) {
+                        trace->Action(time, layerIndex, target, static_cast<unsigned int>(binding.action),
+                                      layers[target].layer->currentPhasorIndex, binding.remaining);
+                    }
+                    layers[target].DoAction(binding.action);
+                    targets &= targets - 1;
+                }
             }
-            auto &action = conditionAction[static_cast<size_t>(id)];
-            action(thisLayer, layerBelow, layerAbove);
         }
 
-        void SetAction(LayerConditionId id, LayerActionFunction action) {
-            conditionAction[static_cast<size_t>(id)] = std::move(action);
+    private:
+        void UpdateArmedMask(size_t c) {
+            unsigned int mask = 0;
+            for (unsigned int i = 0; i < numBindings[c]; ++i) {
+                if (bindings[c][i].remaining != 0) {
+                    mask |= 1u << i;
+                }
+            }
+            armedMask[c] = mask;
         }
     };
 
+    // defined here, since rearming needs the complete LayerBehavior
+    inline void LayerInterface::DoAction(LayerActionId id) {
+        LayerOutputFlagId flag;
+        switch (id) {
+            case LayerActionId::Reset:
+                layer->Reset();
+                flag = LayerOutputFlagId::Reset;
+                break;
+            case LayerActionId::Restart:
+                layer->Restart();
+                flag = LayerOutputFlagId::Restarted;
+                break;
+            case LayerActionId::Pause:
+                layer->Pause();
+                flag = LayerOutputFlagId::Paused;
+                break;
+            case LayerActionId::Resume:
+                layer->Resume();
+                flag = LayerOutputFlagId::Resumed;
+                break;
+            case LayerActionId::StoreTrigger:
+                layer->StoreTrigger();
+                flag = LayerOutputFlagId::Triggered;
+                break;
+            case LayerActionId::StoreReset:
+                layer->StoreReset();
+                flag = LayerOutputFlagId::Reset;
+                break;
+            case LayerActionId::EnableLoop:
+                layer->SetLoopEnabled(true);
+                flag = LayerOutputFlagId::Opened;
+                break;
+            case LayerActionId::DisableLoop:
+                layer->SetLoopEnabled(false);
+                flag = LayerOutputFlagId::Closed;
+                break;
+            case LayerActionId::RearmCounters:
+                behavior->RearmCounters();
+                return;
+            case LayerActionId::NUM_ACTIONS:
+            default:
+                return;
+        }
+        if (outputs) {
+            outputs->flags.Set(flag);
+        }
+    }
+
 
     enum class LayerBehaviorModeId {
         ASYNC,
         MULTIPLY_UNQUANTIZED,
-//        MULTIPLY_QUANTIZED,
-//        MULTIPLY_QUANTIZED_START,
-//        MULTIPLY_QUANTIZED_END,
+        MULTIPLY_QUANTIZED,
+        MULTIPLY_QUANTIZED_START,
+        MULTIPLY_QUANTIZED_END,
         INSERT_UNQUANTIZED,
-//        INSERT_QUANTIZED,
-//        INSERT_QUANTIZED_START,
-//        INSERT_QUANTIZED_END,
+        INSERT_QUANTIZED,
+        INSERT_QUANTIZED_START,
+        INSERT_QUANTIZED_END,
         COUNT,
     };
 
     static constexpr char LayerBehaviorModeIdLabel[static_cast<int>(LayerBehaviorModeId::COUNT)][16] = {
         "ASYNC",
         "MULT",
+        "MULT_Q",
+        "MULT_QS",
+        "MULT_QE",
         "INSERT",
+        "INSERT_Q",
+        "INSERT_QS",
+        "INSERT_QE",
     };
 
+    //------------------------------------------------
+    // multiply: wrapping on a layer resets the layer below
+    static void SetMultiplyActions(LayerBehavior &behavior) {
+        const LayerMask below = behavior.BelowMask();
+        behavior.AddAction(LayerConditionId::OpenLoop, LayerActionId::StoreReset, below, LayerActionGuard::NotInner);
+        behavior.AddAction(LayerConditionId::CloseLoop, LayerActionId::Reset, below, LayerActionGuard::NotInner);
+        behavior.AddAction(LayerConditionId::Wrap, LayerActionId::Reset, below, LayerActionGuard::NotInner);
+    }
+
+    //------------------------------------------------
+    // insert: opening a loop pauses the layer below, which resumes when this layer finishes
+    static void SetInsertActions(LayerBehavior &behavior) {
+        const LayerMask below = behavior.BelowMask();
+        const LayerMask above = behavior.AboveMask();
+        const LayerMask self = behavior.SelfMask();
+        // opening: pause the layer below, and record only a single pass on this layer
+        behavior.AddAction(LayerConditionId::OpenLoop, LayerActionId::StoreTrigger, below, LayerActionGuard::NotInner);
+        behavior.AddAction(LayerConditionId::OpenLoop, LayerActionId::Pause, below, LayerActionGuard::NotInner);
+        behavior.AddAction(LayerConditionId::OpenLoop, LayerActionId::DisableLoop, self, LayerActionGuard::NotInner);
+        // closing or finishing a pass: resume the layer below
+        behavior.AddAction(LayerConditionId::CloseLoop, LayerActionId::Resume, below, LayerActionGuard::NotInner);
+        behavior.AddAction(LayerConditionId::Wrap, LayerActionId::Resume, below, LayerActionGuard::NotInner);
+        // reaching the stored trigger: restart the layer above, and wait for it
+        behavior.AddAction(LayerConditionId::Trigger, LayerActionId::Restart, above, LayerActionGuard::NotOuter);
+        behavior.AddAction(LayerConditionId::Trigger, LayerActionId::Pause, self, LayerActionGuard::NotOuter);
+    }
+
     //------------------------------------------------
     static void SetLayerBehaviorMode(LayerBehavior &behavior, LayerBehaviorModeId modeId) {
         behavior.Clear();
@@ -162,95 +369,41 @@ namespace mlp {
                 // nothing to do! (i think...)
                 break;
             case LayerBehaviorModeId::MULTIPLY_UNQUANTIZED:
-                behavior.SetAction
-                        (LayerConditionId::OpenLoop,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 layerBelow->DoAction(LayerActionId::StoreReset);
-                             }
-                         });
-                behavior.SetAction
-                        (LayerConditionId::CloseLoop,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 layerBelow->DoAction(LayerActionId::Reset);
-                             }
-                         });
-
-                behavior.SetAction
-                        (LayerConditionId::Wrap,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 layerBelow->DoAction(LayerActionId::Reset);
-                             }
-                         });
+                SetMultiplyActions(behavior);
+                break;
+            case LayerBehaviorModeId::MULTIPLY_QUANTIZED:
+                SetMultiplyActions(behavior);
+                behavior.quantizeOpen = true;
+                behavior.quantizeClose = true;
+                break;
+            case LayerBehaviorModeId::MULTIPLY_QUANTIZED_START:
+                SetMultiplyActions(behavior);
+                behavior.quantizeOpen = true;
+                break;
+            case LayerBehaviorModeId::MULTIPLY_QUANTIZED_END:
+                SetMultiplyActions(behavior);
+                behavior.quantizeClose = true;
                 break;
-
             case LayerBehaviorModeId::INSERT_UNQUANTIZED:
-                behavior.SetAction
-                        (LayerConditionId::OpenLoop,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 // std::cout << "insert: open loop, not inner: pause layer below" << std::endl;
-                                 layerBelow->DoAction(LayerActionId::StoreTrigger);
-                                 layerBelow->DoAction(LayerActionId::Pause);
-                                 // std::cout << "insert: open loop, not inner: disable loop on this layer" << std::endl;
-                                 thisLayer->DoAction(LayerActionId::DisableLoop);
-                             } else {
-                                    // std::cout << "insert: open loop, inner: no special action" << std::endl;
-                             }
-                         });
-                behavior.SetAction
-                        (LayerConditionId::CloseLoop,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 // std::cout << "insert: close loop, not inner: resuming layer below" << std::endl;
-                                 layerBelow->DoAction(LayerActionId::Resume);
-                             } else {
-                                 // std::cout << "insert: close loop, inner; no special action" << std::endl;
-                             }
-                         });
-                behavior.SetAction
-                        (LayerConditionId::Wrap,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerAbove;
-                             if (!thisLayer->isInner) {
-                                 // std::cout << "insert: wrapped, resume layer below" << std::endl;
-                                 layerBelow->DoAction(LayerActionId::Resume);
-                             } else {
-                                 // std::cout << "insert: wrapped, inner: no special action" << std::endl;
-                             }
-                         });
-                behavior.SetAction
-                        (LayerConditionId::Trigger,
-                         [](LayerInterface *thisLayer, LayerInterface *layerBelow, LayerInterface *layerAbove) {
-                             (void) layerBelow;
-                             if (!thisLayer->isOuter) {
-                                 // std::cout << "insert: trigger, reset layer above, pause this layer" << std::endl;
-                                 layerAbove->DoAction(LayerActionId::Restart);
-                                 thisLayer->DoAction(LayerActionId::Pause);
-                             } else {
-                                 // std::cout << "insert: trigger, outer: no special action" << std::endl;
-                             }
-                         });
+                SetInsertActions(behavior);
+                break;
+            case LayerBehaviorModeId::INSERT_QUANTIZED:
+                SetInsertActions(behavior);
+                behavior.quantizeOpen = true;
+                behavior.quantizeClose = true;
+                break;
+            case LayerBehaviorModeId::INSERT_QUANTIZED_START:
+                SetInsertActions(behavior);
+                behavior.quantizeOpen = true;
+                break;
+            case LayerBehaviorModeId::INSERT_QUANTIZED_END:
+                SetInsertActions(behavior);
+                behavior.quantizeClose = true;
                 break;
-
-
-//            case LayerBehaviorModeId::MULTIPLY_QUANTIZED:
-//            case LayerBehaviorModeId::MULTIPLY_QUANTIZED_START:
-//            case LayerBehaviorModeId::MULTIPLY_QUANTIZED_END:
-//            case LayerBehaviorModeId::INSERT_QUANTIZED:
-//            case LayerBehaviorModeId::INSERT_QUANTIZED_START:
-//            case LayerBehaviorModeId::INSERT_QUANTIZED_END:
             case LayerBehaviorModeId::COUNT:
             default:
                 // NYI mode
                 break;
         }
     }
-}
+}
\ No newline at end of file
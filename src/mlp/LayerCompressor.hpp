@@ -0,0 +1,449 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "Constants.hpp"
+#include "Types.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // lossless codec for pages of interleaved audio, in any storage format of up to 4 bytes per sample.
+    // each sample is stored as the difference from the previous sample's bit pattern on the same channel,
+    // zigzagged and cut to as few bytes as it needs, with a 4-bit length tag.
+    // silence costs half a byte per sample; nothing ever costs more than half a byte over its raw size.
+    // (bit patterns are read little-endian)
+    template<int numChannels, typename Sample>
+    struct PageCodec {
+        static_assert(sizeof(Sample) <= 4, "samples must fit in 32 bits");
+        static constexpr unsigned int sampleBits = sizeof(Sample) * 8;
+        static constexpr uint32_t sampleMask = sampleBits == 32 ? ~0u : (1u << (sampleBits & 31)) - 1;
+
+        static size_t MaxEncodedBytes(size_t numSamples) {
+            return (numSamples + 1) / 2 + numSamples * sizeof(Sample);
+        }
+
+        // returns the number of bytes written
+        static size_t Encode(const Sample *src, size_t numFrames, uint8_t *dst) {
+            const size_t numSamples = numFrames * numChannels;
+            const size_t numTagBytes = (numSamples + 1) / 2;
+            std::memset(dst, 0, numTagBytes);
+            uint8_t *out = dst + numTagBytes;
+            uint32_t previous[numChannels]{};
+            size_t i = 0;
+            for (size_t frame = 0; frame < numFrames; ++frame) {
+                for (unsigned int ch = 0; ch < numChannels; ++ch, ++i) {
+                    uint32_t bits = 0;
+                    std::memcpy(&bits, src + i, sizeof(Sample));
+                    // sign-extend the difference from the sample's width
+                    const auto delta = static_cast<int32_t>((bits - previous[ch]) << (32 - sampleBits))
+                                       >> (32 - sampleBits);
+                    previous[ch] = bits;
+                    const uint32_t z = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+                    const unsigned int length = z == 0 ? 0 : z < (1u << 8) ? 1 : z < (1u << 16) ? 2 : z < (1u << 24) ? 3 : 4;
+                    dst[i >> 1] |= static_cast<uint8_t>(length << ((i & 1) * 4));
+                    for (unsigned int b = 0; b < length; ++b) {
+                        *out++ = static_cast<uint8_t>(z >> (b * 8));
+                    }
+                }
+            }
+            return static_cast<size_t>(out - dst);
+        }
+
+        static void Decode(const uint8_t *src, size_t numFrames, Sample *dst) {
+            const size_t numSamples = numFrames * numChannels;
+            const uint8_t *in = src + (numSamples + 1) / 2;
+            uint32_t previous[numChannels]{};
+            size_t i = 0;
+            for (size_t frame = 0; frame < numFrames; ++frame) {
+                for (unsigned int ch = 0; ch < numChannels; ++ch, ++i) {
+                    const unsigned int length = (src[i >> 1] >> ((i & 1) * 4)) & 0xf;
+                    uint32_t z = 0;
+                    for (unsigned int b = 0; b < length; ++b) {
+                        z |= static_cast<uint32_t>(*in++) << (b * 8);
+                    }
+                    const uint32_t delta = (z >> 1) ^ (0u - (z & 1u));
+                    previous[ch] = (previous[ch] + delta) & sampleMask;
+                    std::memcpy(dst + i, &previous[ch], sizeof(Sample));
+                }
+            }
+        }
+    };
+
+    //------------------------------------------------
+    // page table for one layer's buffer, for compressing it while the layer is idle (playing, not writing).
+    //
+    // a background thread packs pages of the loop with PageCodec, and gives the memory of packed pages
+    // back to the OS once no voice has used them for a while. before each span, the audio thread
+    // unpacks any page it is about to touch, and flags a page or two ahead of each voice,
+    // so that the background thread usually unpacks them first. pages that are written go back to raw;
+    // as soon as a layer starts writing, the background thread unpacks the rest.
+    //
+    // page state lives in the low 2 bits of a per-page word; the rest counts writes,
+    // so that a page packed from data that changed underneath it is thrown away.
+    template<int numChannels, frame_t bufferFrames, typename Sample>
+    class LayerPages {
+    public:
+        static constexpr frame_t pageFrames = 1 << 14;
+        static constexpr size_t numPages = bufferFrames / pageFrames;
+        static constexpr size_t pageSamples = pageFrames * numChannels;
+        static_assert(bufferFrames % pageFrames == 0, "buffer must be a whole number of pages");
+
+        enum PageState : uint32_t {
+            // plain samples, no valid packed copy
+            Raw,
+            // plain samples, with a matching packed copy
+            Packed,
+            // being released or unpacked; the other thread must wait
+            Busy,
+            // packed copy only; the samples are gone
+            Released,
+        };
+
+    private:
+        typedef PageCodec<numChannels, Sample> Codec;
+        typedef std::vector<uint8_t> PackedData;
+
+        static constexpr uint32_t stateMask = 3;
+
+        Sample *base{nullptr};
+        std::array<std::atomic<uint32_t>, numPages> state{};
+        // frame count at which the audio thread last used (or asked for) each page
+        std::array<std::atomic<frame_t>, numPages> lastUsed{};
+        std::array<std::atomic<PackedData *>, numPages> packed{};
+
+        //--- published by the audio thread
+        std::atomic<bool> isEngaged{false};
+        std::atomic<bool> isIdle{false};
+        std::atomic<frame_t> clock{0};
+        std::atomic<frame_t> regionStart{0};
+        std::atomic<frame_t> regionEnd{0};
+        // set while the audio thread swaps buffers; the background thread leaves the layer alone
+        std::atomic<bool> isSwapping{false};
+
+        //--- background thread only
+        std::atomic<bool> isWorking{false};
+        // write count (plus one) at which each page was last tried, so incompressible pages aren't retried
+        std::array<uint32_t, numPages> triedCount{};
+        std::vector<uint8_t> scratch;
+
+        static size_t PageOf(frame_t frame) {
+            return static_cast<size_t>((frame % bufferFrames) / pageFrames);
+        }
+
+        static uint32_t MakeWord(uint32_t count, PageState s) {
+            return (count << 2) | s;
+        }
+
+        Sample *PageData(size_t page) const {
+            return base + page * pageSamples;
+        }
+
+        // wait out the background thread, if it is releasing or unpacking this page;
+        // it only ever holds one page, for about as long as it takes to decode it
+        uint32_t WaitUntilNotBusy(size_t page) const {
+            uint32_t word = state[page].load();
+            while ((word & stateMask) == Busy) {
+                std::this_thread::yield();
+                word = state[page].load();
+            }
+            return word;
+        }
+
+        // unpack a released page that this thread has claimed, and mark it packed
+        void Unpack(size_t page, uint32_t word) {
+            Codec::Decode(packed[page].load()->data(), pageFrames, PageData(page));
+            state[page].store((word & ~stateMask) | Packed);
+        }
+
+        static uintptr_t OsPageSize() {
+#if defined(_WIN32)
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return static_cast<uintptr_t>(info.dwPageSize);
+#else
+            return static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+#endif
+        }
+
+        // let the OS take back the memory under a page. its contents are undefined afterwards,
+        // but it stays mapped, so unpacking just writes over it
+        static void ReleaseMemory(Sample *data, size_t numBytes) {
+            // only whole OS pages can be released
+            static const uintptr_t osPage = OsPageSize();
+            const auto start = (reinterpret_cast<uintptr_t>(data) + osPage - 1) & ~(osPage - 1);
+            const auto end = (reinterpret_cast<uintptr_t>(data) + numBytes) & ~(osPage - 1);
+            if (end <= start) {
+                return;
+            }
+#if defined(__linux__)
+            madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED);
+#elif defined(__APPLE__)
+            madvise(reinterpret_cast<void *>(start), end - start, MADV_FREE);
+#elif defined(_WIN32)
+            VirtualAlloc(reinterpret_cast<void *>(start), end - start, MEM_RESET, PAGE_READWRITE);
+#endif
+        }
+
+        bool ShouldAbort() const {
+            return isSwapping.load();
+        }
+
+        bool IsRecent(size_t page, frame_t now, frame_t guardFrames) const {
+            return lastUsed[page].load() + guardFrames >= now;
+        }
+
+        void TryPack(size_t page) {
+            const uint32_t word = state[page].load();
+            if ((word & stateMask) != Raw || triedCount[page] == (word >> 2) + 1) {
+                return;
+            }
+            triedCount[page] = (word >> 2) + 1;
+            const size_t numBytes = Codec::Encode(PageData(page), pageFrames, scratch.data());
+            if (numBytes >= pageSamples * sizeof(Sample)) {
+                return;
+            }
+            delete packed[page].load();
+            packed[page].store(new PackedData(scratch.begin(), scratch.begin() + static_cast<long>(numBytes)));
+            uint32_t expected = word;
+            // fails if the page was written while packing
+            state[page].compare_exchange_strong(expected, (word & ~stateMask) | Packed);
+        }
+
+        void TryRelease(size_t page, frame_t now, frame_t guardFrames) {
+            uint32_t word = state[page].load();
+            if ((word & stateMask) != Packed || IsRecent(page, now, guardFrames)) {
+                return;
+            }
+            if (!state[page].compare_exchange_strong(word, (word & ~stateMask) | Busy)) {
+                return;
+            }
+            // the audio thread marks a page used before looking at its state,
+            // so if it is about to read this page, it either waits for us or we see it here
+            if (IsRecent(page, clock.load(), guardFrames)) {
+                state[page].store(word);
+                return;
+            }
+            ReleaseMemory(PageData(page), pageSamples * sizeof(Sample));
+            state[page].store((word & ~stateMask) | Released);
+        }
+
+        void TryUnpack(size_t page) {
+            uint32_t word = state[page].load();
+            if ((word & stateMask) != Released) {
+                return;
+            }
+            if (state[page].compare_exchange_strong(word, (word & ~stateMask) | Busy)) {
+                Unpack(page, word);
+            }
+        }
+
+        // packed copies of pages that have since been written are no use
+        void FreeStalePage(size_t page) {
+            if ((state[page].load() & stateMask) == Raw && packed[page].load() != nullptr) {
+                delete packed[page].exchange(nullptr);
+            }
+        }
+
+    public:
+        ~LayerPages() {
+            for (auto &p: packed) {
+                delete p.load();
+            }
+        }
+
+        //------------------------------------------------
+        //--- audio thread
+
+        bool IsEngaged() const {
+            return isEngaged.load(std::memory_order_relaxed);
+        }
+
+        // point at a new buffer. pages are all raw afterwards, and any packed copies are dropped
+        void SetBuffer(Sample *aBuffer) {
+            isSwapping.store(true);
+            while (isWorking.load()) {
+                std::this_thread::yield();
+            }
+            base = aBuffer;
+            for (size_t page = 0; page < numPages; ++page) {
+                state[page].store(MakeWord((state[page].load() >> 2) + 1, Raw));
+            }
+            isSwapping.store(false);
+        }
+
+        // note the time, and which part of the buffer may be packed
+        void Publish(frame_t now, bool aIsIdle, frame_t start, frame_t end) {
+            clock.store(now, std::memory_order_relaxed);
+            // release, so that the background thread sees everything written before the layer went idle
+            isIdle.store(aIsIdle, std::memory_order_release);
+            regionStart.store(start, std::memory_order_relaxed);
+            regionEnd.store(end, std::memory_order_relaxed);
+        }
+
+        // make sure the page holding this frame has its samples
+        void Use(frame_t frame, frame_t now) {
+            const size_t page = PageOf(frame);
+            lastUsed[page].store(now);
+            uint32_t word = WaitUntilNotBusy(page);
+            if ((word & stateMask) == Released
+                && state[page].compare_exchange_strong(word, (word & ~stateMask) | Busy)) {
+                Unpack(page, word);
+            }
+        }
+
+        // ask for the page holding this frame to be kept, or unpacked in the background
+        void Request(frame_t frame, frame_t now) {
+            lastUsed[PageOf(frame)].store(now);
+        }
+
+        // mark the (already used) page holding this frame as about to be written
+        void MarkWritten(frame_t frame) {
+            const size_t page = PageOf(frame);
+            uint32_t word = WaitUntilNotBusy(page);
+            while (!state[page].compare_exchange_weak(word, MakeWord((word >> 2) + 1, Raw))) {
+                word = WaitUntilNotBusy(page);
+            }
+        }
+
+        //------------------------------------------------
+        //--- background thread
+
+        void Engage() {
+            scratch.resize(Codec::MaxEncodedBytes(pageSamples));
+            isEngaged.store(true);
+        }
+
+        // unpack everything, then stop the audio thread from checking pages
+        void Disengage() {
+            for (size_t page = 0; page < numPages; ++page) {
+                WaitUntilNotBusy(page);
+                TryUnpack(page);
+            }
+            isEngaged.store(false);
+            for (size_t page = 0; page < numPages; ++page) {
+                state[page].store(MakeWord((state[page].load() >> 2) + 1, Raw));
+                delete packed[page].exchange(nullptr);
+            }
+        }
+
+        // one pass over the layer: pack and release the idle loop, or unpack it all if the layer is writing.
+        // pages used within guardFrames are kept
+        void Work(frame_t guardFrames) {
+            isWorking.store(true);
+            if (ShouldAbort() || base == nullptr) {
+                isWorking.store(false);
+                return;
+            }
+            const frame_t now = clock.load();
+            if (isIdle.load(std::memory_order_acquire)) {
+                const frame_t start = regionStart.load();
+                const frame_t end = regionEnd.load();
+                for (frame_t frame = start - start % pageFrames; frame < end && !ShouldAbort(); frame += pageFrames) {
+                    const size_t page = PageOf(frame);
+                    if ((state[page].load() & stateMask) == Released) {
+                        if (IsRecent(page, now, guardFrames)) {
+                            TryUnpack(page);
+                        }
+                    } else {
+                        TryPack(page);
+                        TryRelease(page, now, guardFrames);
+                    }
+                }
+            } else {
+                for (size_t page = 0; page < numPages && !ShouldAbort(); ++page) {
+                    TryUnpack(page);
+                }
+            }
+            for (size_t page = 0; page < numPages && !ShouldAbort(); ++page) {
+                FreeStalePage(page);
+            }
+            isWorking.store(false);
+        }
+    };
+
+    //------------------------------------------------
+    // runs the background side of LayerPages for all layers.
+    // start and stop from a control thread, never from the audio thread
+    template<int numChannels, frame_t bufferFrames, typename Sample>
+    class LayerCompressor {
+        typedef LayerPages<numChannels, bufferFrames, Sample> Pages;
+        std::array<Pages *, numLoopLayers> layers{};
+        std::thread thread;
+        std::atomic<bool> shouldRun{false};
+
+        static constexpr auto interval = std::chrono::milliseconds(10);
+
+    public:
+        // whether released pages go back to the OS here; elsewhere, packing would only add to memory use
+#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+        static constexpr bool isSupported = true;
+#else
+        static constexpr bool isSupported = false;
+#endif
+
+        ~LayerCompressor() {
+            Stop();
+        }
+
+        void SetLayer(unsigned int index, Pages *pages) {
+            layers[index] = pages;
+        }
+
+        bool IsRunning() const {
+            return thread.joinable();
+        }
+
+        // does nothing where memory can't be released (see `isSupported`)
+        void Start() {
+            if (!isSupported || IsRunning()) {
+                return;
+            }
+            for (auto *pages: layers) {
+                pages->Engage();
+            }
+            shouldRun = true;
+            thread = std::thread([this] {
+                // keep about two pages' worth of frames around each voice
+                constexpr frame_t guardFrames = Pages::pageFrames * 2;
+                while (shouldRun) {
+                    for (auto *pages: layers) {
+                        pages->Work(guardFrames);
+                    }
+                    std::this_thread::sleep_for(interval);
+                }
+            });
+        }
+
+        void Stop() {
+            if (!IsRunning()) {
+                return;
+            }
+            shouldRun = false;
+            thread.join();
+            for (auto *pages: layers) {
+                pages->Disengage();
+            }
+        }
+    };
+
+}
@@ -5,8 +5,13 @@
 
 #include "LayerBehavior.hpp"
 
+#include "GainMatrix.hpp"
+#include "LayerCompressor.hpp"
 #include "Outputs.hpp"
 #include "Phasor.hpp"
+#include "SampleFormat.hpp"
+#include "SampleStorage.hpp"
+#include "SmoothParam.hpp"
 #include "SmoothSwitch.hpp"
 #include "Types.hpp"
 
@@ -21,22 +26,44 @@ namespace mlp {
 
     //---------------------------------------------------
     // a simple multichannel play/record structure
-    template<int numChannels, frame_t bufferFrames>
+    // with a small pool of read/write voices (phasors), so that rapid resets can overlap their crossfades.
+    // the buffer holds samples in the given storage format (see SampleStorage.hpp),
+    // and per-frame processing is in the given number format (see SampleFormat.hpp)
+    template<int numChannels, frame_t bufferFrames, int numVoices = numLayerVoices, typename Storage = LoopStorage,
+            typename Format = LoopFormat>
     struct LoopLayer {
+        static_assert(numVoices >= 2 && numVoices <= 32, "voice mask must fit in 32 bits");
+        static constexpr unsigned int allVoicesMask = static_cast<unsigned int>((1ull << numVoices) - 1);
+        typedef typename Storage::Element Sample;
+        typedef typename Format::Audio Audio;
+        typedef typename Format::Gain Gain;
+        typedef typename Format::Frames Frames;
+
         ///---- the audio buffer!
-        float *buffer;
+        Sample *buffer;
+        // packs the buffer while the layer is idle, if enabled (see LayerCompressor.hpp)
+        LayerPages<numChannels, bufferFrames, Sample> pages;
+        // random state for formats which dither on writing
+        uint32_t ditherSeed{1};
 
         //--- sub-processors
-        std::array<FadePhasor, 2> phasor;
-        SmoothSwitch writeSwitch;
-        SmoothSwitch readSwitch;
-        SmoothSwitch clearSwitch;
+        std::array<FadePhasor<Format>, numVoices> phasor;
+        SmoothSwitch<Format> writeSwitch;
+        SmoothSwitch<Format> readSwitch;
+        SmoothSwitch<Format> clearSwitch;
+        // mixes buffer channels to output channels
+        GainMatrix<numChannels, numChannels, Format> outputMatrix;
 
         ///--- runtime state
         LoopLayerState state{LoopLayerState::STOPPED};
         bool stopPending{false};
+        // the voice which is logically playing; others are fading out (or idle)
         unsigned int currentPhasorIndex{0};
-        unsigned int lastPhasorIndex{1};
+        // bitmask of voices that are active (playing or fading)
+        unsigned int activeVoices{0};
+        // order in which voices were started, for stealing the oldest
+        std::array<unsigned long int, numVoices> voiceStartCount{};
+        unsigned long int voiceStartCounter{0};
 
         ///---- parameters
         // jump to this frame on external reset
@@ -53,9 +80,15 @@ namespace mlp {
         float fadeIncrement;
 
         /// levels
-        float playbackLevel{1.f};
-        float recordLevel{1.f};
-        float preserveLevel{1.f};
+        SmoothParam<Gain> playbackLevel{1.f};
+        SmoothParam<Gain> recordLevel{1.f};
+        SmoothParam<Gain> preserveLevel{1.f};
+
+        /// read head delay behind the write head, in frames
+        SmoothParam<Frames> readOffset{0.f};
+
+        /// output spatialization
+        StereoField stereoField;
 
         /// behavior flags
         bool loopEnabled{true};
@@ -73,33 +106,60 @@ namespace mlp {
             state = LoopLayerState::SETTING;
             SetWrite(true);
 
-            //// FIXME: we are hitting some state where both phasors are active while the layer is stopped
-            // assert(phasor[currentPhasorIndex].isActive == false);
-
-            phasor[currentPhasorIndex].Reset();
+            StartVoice(0);
             std::cout << "[LoopLayer] opened loop" << std::endl;
         }
 
 
-        void CloseLoop(bool shouldUnmute = true, bool shouldDub = false) {
+        // playbackAdvance: start playing this many frames into the loop, e.g. to make up for output latency
+        void CloseLoop(bool shouldUnmute = true, bool shouldDub = false, frame_t playbackAdvance = 0) {
             state = LoopLayerState::PLAYING;
             SetRead(shouldUnmute);
             SetWrite(shouldDub);
-            lastPhasorIndex = currentPhasorIndex;
-            currentPhasorIndex ^= 1;
-
-            auto &oldPhasor = phasor[lastPhasorIndex];
-            auto &newPhasor = phasor[currentPhasorIndex];
 
-            loopEndFrame = newPhasor.maxFrame = oldPhasor.maxFrame = oldPhasor.currentFrame;
-            oldPhasor.isFadingOut = true;
+            auto &oldPhasor = phasor[currentPhasorIndex];
+            loopEndFrame = oldPhasor.maxFrame = oldPhasor.currentFrame;
             if (loopEnabled) {
                 std::cout << "[LoopLayer] closing loop; looping enabled; resetting" << std::endl;
-                newPhasor.Reset(loopStartFrame);
+                const frame_t loopFrames = loopEndFrame - loopStartFrame;
+                StartVoice(loopStartFrame + (loopFrames > 0 ? playbackAdvance % loopFrames : 0));
             } else {
                 std::cout << "[LoopLayer] closing loop; looping disabled" << std::endl;
+                FadeOutVoices();
+                // the logically current voice is idle until the layer is reset
+                currentPhasorIndex = AcquireVoice();
+            }
+            std::cout << "[LoopLayer] closed loop; length = " << loopEndFrame << std::endl;
+        }
+
+        // take over a buffer which already holds audio between the given frames (e.g. the kernel's input history),
+        // and play it as a closed loop. returns the previous buffer, which the caller now owns.
+        // frames may run past the end of the buffer; they wrap, like all buffer access.
+        // voices still sounding belong to the previous buffer, so they are dropped
+        Sample *AdoptLoop(Sample *aBuffer, frame_t startFrame, frame_t endFrame) {
+            Sample *previousBuffer = buffer;
+            SetBuffer(aBuffer);
+            activeVoices = 0;
+            stopPending = false;
+            state = LoopLayerState::PLAYING;
+            SetRead(true);
+            SetWrite(false);
+
+            loopStartFrame = startFrame;
+            loopEndFrame = endFrame;
+            resetFrame = startFrame;
+            pauseFrame = startFrame;
+            if (loopEnabled) {
+                StartVoice(loopStartFrame);
+            } else {
+                currentPhasorIndex = AcquireVoice();
             }
-            std::cout << "[LoopLayer] closed loop; length = " << newPhasor.maxFrame << std::endl;
+            return previousBuffer;
+        }
+
+        void SetBuffer(Sample *aBuffer) {
+            buffer = aBuffer;
+            pages.SetBuffer(aBuffer);
         }
 
         bool ToggleWrite() {
@@ -140,95 +200,237 @@ namespace mlp {
 
         void Stop() {
             stopPending = true;
-            for (auto &thePhasor: phasor) {
-                if (thePhasor.isActive) {
-                    thePhasor.isFadingOut = true;
+            FadeOutVoices();
+        }
+
+        //------------------------------------------------
+        //-- voice management
+
+        // fade out all active voices
+        void FadeOutVoices() {
+            for (unsigned int v = 0; v < numVoices; ++v) {
+                if (activeVoices & (1u << v)) {
+                    phasor[v].isFadingOut = true;
                 }
             }
         }
 
-        // given a phasor, read from the buffer according to its frame position,
-        // and scale the output by its fade value,
-        // mixing into the given interleaved audio frame
-        void ReadPhasor(float *dst, const FadePhasor &aPhasor) {
-            //auto bufIdx = (phasor.currentFrame + phasor.frameOffset) % bufferFrames;
-            auto bufIdx = aPhasor.currentFrame % bufferFrames;
+        // get the index of an idle voice, or steal the oldest one
+        unsigned int AcquireVoice() const {
+            const unsigned int idle = ~activeVoices & allVoicesMask;
+            if (idle != 0) {
+                return LowestSetBit(idle);
+            }
+            unsigned int oldest = 0;
+            for (unsigned int v = 1; v < numVoices; ++v) {
+                if (voiceStartCount[v] < voiceStartCount[oldest]) {
+                    oldest = v;
+                }
+            }
+            return oldest;
+        }
+
+        // start a new voice at the given position, making it current; all other voices fade out
+        void StartVoice(frame_t position) {
+            FadeOutVoices();
+            const unsigned int v = AcquireVoice();
+            currentPhasorIndex = v;
+            phasor[v].maxFrame = loopEndFrame;
+            phasor[v].Reset(position);
+            voiceStartCount[v] = ++voiceStartCounter;
+            activeVoices |= 1u << v;
+        }
+
+        // map a (possibly negative) read frame into the buffer,
+        // wrapping within the loop if it has been closed
+        frame_t WrapReadFrame(long int frame) const {
+            if (frame < static_cast<long int>(loopStartFrame) && state == LoopLayerState::PLAYING) {
+                const auto loopFrames = static_cast<long int>(loopEndFrame - loopStartFrame);
+                if (loopFrames > 0) {
+                    frame += loopFrames * ((static_cast<long int>(loopStartFrame) - frame + loopFrames - 1) / loopFrames);
+                }
+            }
+            const auto n = static_cast<long int>(bufferFrames);
+            return static_cast<frame_t>(((frame % n) + n) % n);
+        }
+
+        static Audio Load(const Sample &e) {
+            return Format::template Load<Storage>(e);
+        }
+
+        // read an interleaved frame at a fractional position behind the given frame,
+        // using 4-point hermite interpolation
+        void ReadInterpolated(frame_t frame, Frames offset, Audio *dst) const {
+            long int offsetFrames;
+            // fractional position between frames i0 and i1
+            Gain mu;
+            Format::SplitOffset(offset, offsetFrames, mu);
+            const long int i0 = static_cast<long int>(frame) - offsetFrames;
+            const Sample *pm1 = buffer + WrapReadFrame(i0 - 1) * numChannels;
+            const Sample *p0 = buffer + WrapReadFrame(i0) * numChannels;
+            const Sample *p1 = buffer + WrapReadFrame(i0 + 1) * numChannels;
+            const Sample *p2 = buffer + WrapReadFrame(i0 + 2) * numChannels;
             for (unsigned int ch = 0; ch < numChannels; ++ch) {
-                auto x = buffer[(bufIdx * numChannels) + ch];
-                auto a = aPhasor.fadeValue * readSwitch.level * playbackLevel;
-                *(dst + ch) += x * a;
+                dst[ch] = Format::Hermite(Load(pm1[ch]), Load(p0[ch]), Load(p1[ch]), Load(p2[ch]), mu);
+            }
+        }
+
+        // given a phasor, read from the buffer according to its frame position (less the read offset),
+        // scale by its fade value, and accumulate into the given interleaved voice mix
+        void ReadPhasor(Audio *mix, const FadePhasor<Format> &aPhasor) {
+            const Gain a = aPhasor.fadeValue;
+            const Frames offset = readOffset.Get();
+            if (offset == Frames{}) {
+                auto bufIdx = aPhasor.currentFrame % bufferFrames;
+                const Sample *x = buffer + (bufIdx * numChannels);
+                for (unsigned int ch = 0; ch < numChannels; ++ch) {
+                    mix[ch] += Load(x[ch]) * a;
+                }
+            } else {
+                Audio x[numChannels];
+                ReadInterpolated(aPhasor.currentFrame, offset, x);
+                for (unsigned int ch = 0; ch < numChannels; ++ch) {
+                    mix[ch] += x[ch] * a;
+                }
             }
         }
 
         // given a phasor, write to the buffer according to its frame position,
         // scaling record/preserve levels by its fade value
-        void WritePhasor(const float *src, const FadePhasor &aPhasor) {
+        void WritePhasor(const Audio *src, const FadePhasor<Format> &aPhasor) {
             auto bufIdx = aPhasor.currentFrame % bufferFrames;
+            const Gain one = Format::gainOne;
             /// FIXME: maybe linear inversion of the switch is not ideal
-            float modPreserve = preserveLevel * (1-clearSwitch.level);
+            Gain modPreserve = preserveLevel.Get() * (one - clearSwitch.level);
             /// we want to modulate the preserve level towards unity as the phasor fades out
-            modPreserve += (1.f - modPreserve) * (1.f - aPhasor.fadeValue);
+            modPreserve += (one - modPreserve) * (one - aPhasor.fadeValue);
             /// and also as the write switch disengages
             /// (TODO: maybe profile this conditional)
             // if (!writeSwitch.isOpen && writeSwitch.isSwitching) {
-                float switchLevel = writeSwitch.level;
-                modPreserve += (1.f - modPreserve) * (1 - switchLevel);
+                Gain switchLevel = writeSwitch.level;
+                modPreserve += (one - modPreserve) * (one - switchLevel);
             // }
             for (unsigned int ch = 0; ch < numChannels; ++ch) {
-                float x = *(src + ch);
-                float modRecord = recordLevel * aPhasor.fadeValue;
+                Audio x = *(src + ch);
+                Gain modRecord = recordLevel.Get() * aPhasor.fadeValue;
                 modRecord *= writeSwitch.level;
                 x *= modRecord;
-                float y = buffer[(bufIdx * numChannels) + ch];
+                Audio y = Load(buffer[(bufIdx * numChannels) + ch]);
                 y *= modPreserve;
                 x += y;
-                buffer[(bufIdx * numChannels) + ch] = x;
+                Format::template Store<Storage>(buffer[(bufIdx * numChannels) + ch], x, ditherSeed);
+            }
+        }
+
+        // block-rate updates; call before processing the block's frames
+        void BeginBlock(unsigned int numFrames) {
+            outputMatrix.BeginBlock(numFrames);
+            playbackLevel.BeginBlock(numFrames);
+            recordLevel.BeginBlock(numFrames);
+            preserveLevel.BeginBlock(numFrames);
+            readOffset.BeginBlock(numFrames);
+        }
+
+        // call before each span of frames, while the layer's pages are being compressed.
+        // unpacks any page that the voices will read or write during the span, and marks written pages raw
+        void BeginSpan(unsigned int numFrames, frame_t now) {
+            if (!pages.IsEngaged()) {
+                return;
+            }
+            const bool isWriting = writeSwitch.IsActive();
+            pages.Publish(now, state != LoopLayerState::SETTING && !isWriting, loopStartFrame, loopEndFrame);
+            if (state == LoopLayerState::STOPPED) {
+                return;
+            }
+            constexpr auto pageFrames = static_cast<long int>(decltype(pages)::pageFrames);
+            // reads reach back by the read offset (wherever it ramps to), plus the interpolator's width
+            const auto before = static_cast<long int>(ceilf(fmaxf(ToFloat(readOffset.Get()), readOffset.blockEnd))) + 1;
+            const auto after = static_cast<long int>(numFrames) + 2;
+            for (unsigned int v = 0; v < numVoices; ++v) {
+                if (!(activeVoices & (1u << v))) {
+                    continue;
+                }
+                const auto frame = static_cast<long int>(phasor[v].currentFrame);
+                for (long int f = frame - before; ; f += pageFrames) {
+                    pages.Use(WrapReadFrame(f < frame + after ? f : frame + after), now);
+                    if (f >= frame + after) {
+                        break;
+                    }
+                }
+                pages.Request(WrapReadFrame(frame + after + pageFrames), now);
+                if (isWriting) {
+                    for (long int f = frame; ; f += pageFrames) {
+                        pages.MarkWritten(static_cast<frame_t>(f < frame + after ? f : frame + after));
+                        if (f >= frame + after) {
+                            break;
+                        }
+                    }
+                }
             }
+            // voices may jump here at any time
+            pages.Request(loopStartFrame, now);
+            pages.Request(resetFrame, now);
         }
 
-        PhasorAdvanceResult ProcessFrame(const float *src, float *dst) {
+        PhasorAdvanceResult ProcessFrame(const Audio *src, Audio *dst) {
             if (state == LoopLayerState::STOPPED) {
                 PhasorAdvanceResult result;
                 result.Set(PhasorAdvanceResultFlag::INACTIVE);
                 return result;
             }
             if (readSwitch.Process()) {
-                for (const auto &thePhasor: phasor) {
-                    if (thePhasor.isActive) {
-                        ReadPhasor(dst, thePhasor);
+                // mix all active voices, then spatialize the mix once
+                Audio mix[numChannels]{};
+                for (unsigned int v = 0; v < numVoices; ++v) {
+                    if (activeVoices & (1u << v)) {
+                        ReadPhasor(mix, phasor[v]);
                     }
                 }
+                outputMatrix.Apply(mix, dst, readSwitch.level * playbackLevel.Get());
             }
+            outputMatrix.Advance();
+            if (!readOffset.IsConstant()) readOffset.Advance();
             if (writeSwitch.Process()) {
-                for (const auto &thePhasor: phasor) {
-                    if (thePhasor.isActive) {
-                        WritePhasor(src, thePhasor);
+                for (unsigned int v = 0; v < numVoices; ++v) {
+                    if (activeVoices & (1u << v)) {
+                        WritePhasor(src, phasor[v]);
                     }
                 }
             }
             clearSwitch.Process();
+            if (!playbackLevel.IsConstant()) playbackLevel.Advance();
+            if (!recordLevel.IsConstant()) recordLevel.Advance();
+            if (!preserveLevel.IsConstant()) preserveLevel.Advance();
+
+            // only the current voice reports conditions
+            PhasorAdvanceResult result;
+            for (unsigned int v = 0; v < numVoices; ++v) {
+                if (activeVoices & (1u << v)) {
+                    if (v == currentPhasorIndex) {
+                        result = phasor[v].Advance();
+                    } else {
+                        phasor[v].Advance();
+                    }
+                    if (!phasor[v].isActive) {
+                        activeVoices &= ~(1u << v);
+                    }
+                }
+            }
+            if (!(activeVoices & (1u << currentPhasorIndex))) {
+                result.Set(PhasorAdvanceResultFlag::INACTIVE);
+            }
 
-            assert(lastPhasorIndex != currentPhasorIndex);
-
-            phasor[lastPhasorIndex].Advance();
-            auto result = phasor[currentPhasorIndex].Advance();
-
-            if (result.Test(PhasorAdvanceResultFlag::DONE_FADEOUT)) {
-
-                if (stopPending) {
+            if (stopPending && activeVoices == 0) {
 //                    SetRead(false);
 //                    SetWrite(false);
-                    state = LoopLayerState::STOPPED;
-                    stopPending = false;
-                    if(outputs) outputs->flags.Set(LayerOutputFlagId::Stopped);
-                }
+                state = LoopLayerState::STOPPED;
+                stopPending = false;
+                if(outputs) outputs->flags.Set(LayerOutputFlagId::Stopped);
             }
 
             if (result.Test(PhasorAdvanceResultFlag::WRAPPED_LOOP)) {
                 if (loopEnabled) {
-                    lastPhasorIndex = currentPhasorIndex;
-                    currentPhasorIndex ^= 1;
-                    phasor[currentPhasorIndex].Reset(loopStartFrame);
+                    StartVoice(loopStartFrame);
                     if (outputs) outputs->flags.Set(LayerOutputFlagId::Looped);
                 } else {
                     stopPending = true;
@@ -240,11 +442,7 @@ namespace mlp {
         }
 
         void Reset() {
-            lastPhasorIndex = currentPhasorIndex;
-            currentPhasorIndex ^= 1;
-            phasor[currentPhasorIndex].maxFrame = loopEndFrame;
-            phasor[lastPhasorIndex].isFadingOut = true;
-            phasor[currentPhasorIndex].Reset(resetFrame);
+            StartVoice(resetFrame);
             state = LoopLayerState::PLAYING;
         }
 
@@ -264,26 +462,9 @@ namespace mlp {
         }
 
         void Resume() {
-            for (unsigned int i=0; i<2; ++i) {
-                auto &thePhasor = phasor[i];
-                if (!thePhasor.isActive) {
-                    currentPhasorIndex = i;
-                    if (lastPhasorIndex == currentPhasorIndex) {
-                        lastPhasorIndex = currentPhasorIndex ^ 1;
-                    }
-                    thePhasor.Reset(pauseFrame);
-                    return;
-                }
-            }
-
-            // shouldn't really get here
-            std::cerr << "[LoopLayer] resume failed - already playing + in a crossfade?" << std::endl;
-            /// just swap them i guess
-            currentPhasorIndex = lastPhasorIndex;
-            lastPhasorIndex = currentPhasorIndex ^ 1;
-            phasor[currentPhasorIndex].Reset(pauseFrame);
-            ///... hm...
-            SetRead(true);
+            // with a voice pool there is always a voice to resume on;
+            // if all are busy, the oldest is stolen
+            StartVoice(pauseFrame);
         }
 
         void StoreTrigger() {
@@ -298,6 +479,44 @@ namespace mlp {
             return phasor[currentPhasorIndex].currentFrame;
         }
 
+        frame_t GetLoopFrames() const {
+            return loopEndFrame - loopStartFrame;
+        }
+
+        // number of frames to process before the current voice wraps,
+        // or zero if the layer is not playing a closed loop
+        frame_t GetFramesUntilWrap() const {
+            if (state != LoopLayerState::PLAYING || stopPending || !loopEnabled) {
+                return 0;
+            }
+            const auto &thePhasor = phasor[currentPhasorIndex];
+            if (!(activeVoices & (1u << currentPhasorIndex)) || thePhasor.isFadingOut
+                || thePhasor.currentFrame >= thePhasor.maxFrame) {
+                return 0;
+            }
+            return thePhasor.maxFrame - thePhasor.currentFrame;
+        }
+
+        // number of frames to process until the current voice next reports a wrap or trigger,
+        // counting the frame on which it is reported; or zero if neither is coming
+        frame_t GetFramesUntilCondition() const {
+            if (state == LoopLayerState::STOPPED || !(activeVoices & (1u << currentPhasorIndex))) {
+                return 0;
+            }
+            const auto &thePhasor = phasor[currentPhasorIndex];
+            frame_t frames = 0;
+            if (!thePhasor.isFadingOut && thePhasor.maxFrame > thePhasor.currentFrame) {
+                frames = thePhasor.maxFrame - thePhasor.currentFrame;
+            }
+            if (thePhasor.triggerFrame > thePhasor.currentFrame) {
+                frame_t triggerFrames = thePhasor.triggerFrame - thePhasor.currentFrame;
+                if (frames == 0 || triggerFrames < frames) {
+                    frames = triggerFrames;
+                }
+            }
+            return frames;
+        }
+
         void SetResetFrame(frame_t frame) {
             resetFrame = frame;
             if (resetFrame > loopEndFrame) {
@@ -314,6 +533,10 @@ namespace mlp {
             if (triggerFrame > loopEndFrame) {
                 triggerFrame = loopEndFrame;
             }
+            if (triggerFrame <= loopStartFrame && state == LoopLayerState::PLAYING) {
+                // the phasor can never cross its start frame, but the loop end is the same point in the loop
+                triggerFrame = loopEndFrame;
+            }
             if (triggerFrame < loopStartFrame) {
                 triggerFrame = loopStartFrame;
             }
@@ -325,7 +548,7 @@ namespace mlp {
         void SetFadeIncrement(float increment) {
             fadeIncrement = increment;
             for (auto &thePhasor: phasor) {
-                thePhasor.fadeIncrement = increment;
+                thePhasor.fadeIncrement = FromFloat<typename Format::Phase>(increment);
             }
         }
 
@@ -336,6 +559,41 @@ namespace mlp {
             clearSwitch.SetDelta(increment);
         }
 
+        void SetLevelSmoothTime(float frames) {
+            playbackLevel.SetTime(frames);
+            recordLevel.SetTime(frames);
+            preserveLevel.SetTime(frames);
+        }
+
+        void SetLevelSmoothMode(SmoothParamMode mode) {
+            playbackLevel.SetMode(mode);
+            recordLevel.SetMode(mode);
+            preserveLevel.SetMode(mode);
+        }
+
+        void SetReadOffset(float frames) {
+            readOffset.SetTarget(frames < 0.f ? 0.f : frames);
+        }
+
+        void SetReadOffsetSmoothTime(float frames) {
+            readOffset.SetTime(frames);
+        }
+
+        void SetPan(float value) {
+            stereoField.pan = value;
+            outputMatrix.SetTarget(stereoField.ComputeMatrix());
+        }
+
+        void SetWidth(float value) {
+            stereoField.width = value;
+            outputMatrix.SetTarget(stereoField.ComputeMatrix());
+        }
+
+        void SetBalance(float value) {
+            stereoField.balance = value;
+            outputMatrix.SetTarget(stereoField.ComputeMatrix());
+        }
+
         bool GetIsActive() const {
             if (state == LoopLayerState::STOPPED) {
                 return false;
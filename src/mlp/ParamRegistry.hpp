@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cmath>
+
+namespace mlp {
+
+    class Kernel;
+
+    //------------------------------------------------
+    // description of a continuous parameter, from which its control surfaces and its setter are made.
+    // values arrive normalized, and are mapped to the kernel's units by `min + (max - min) * value^curve`
+    // (values outside [0, 1] extrapolate; only a `curve` of 1 makes sense for those)
+
+    enum class ParamScope : int {
+        // one value per layer; the global form of the parameter sets the current layer
+        Layer,
+        // one value for the whole looper
+        Global
+    };
+
+    struct FloatParamInfo {
+        const char *label;
+        // in the kernel's units
+        float min;
+        float max;
+        float defaultValue;
+        // exponent applied to the normalized value; 1 is linear
+        float curve;
+        ParamScope scope;
+        // apply a mapped value to a layer, or to the current layer if the index is negative
+        void (*set)(Kernel &kernel, float value, int layerIndex);
+
+        float Map(float value) const {
+            return min + (max - min) * std::pow(value, curve);
+        }
+
+        float Normalize(float mappedValue) const {
+            return std::pow((mappedValue - min) / (max - min), 1.f / curve);
+        }
+    };
+
+    // fixed-width label strings, in the shape the rest of the API uses for labels
+    template<unsigned int numLabels, unsigned int labelSize>
+    struct LabelTable {
+        char labels[numLabels][labelSize]{};
+    };
+
+    template<unsigned int numLabels, unsigned int labelSize, unsigned int numParams>
+    constexpr LabelTable<numLabels, labelSize> MakeLabelTable(const FloatParamInfo (&params)[numParams]) {
+        static_assert(numLabels <= numParams, "more labels than parameters");
+        LabelTable<numLabels, labelSize> table{};
+        for (unsigned int i = 0; i < numLabels; ++i) {
+            for (unsigned int j = 0; j + 1 < labelSize && params[i].label[j] != '\0'; ++j) {
+                table.labels[i][j] = params[i].label[j];
+            }
+        }
+        return table;
+    }
+
+    // whether exactly the first `numLayerParams` entries are per-layer
+    template<unsigned int numParams>
+    constexpr bool AreLayerParamsFirst(const FloatParamInfo (&params)[numParams], unsigned int numLayerParams) {
+        for (unsigned int i = 0; i < numParams; ++i) {
+            if ((params[i].scope == ParamScope::Layer) != (i < numLayerParams)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "Types.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // latest-value store for continuous parameters.
+    // any thread may write a slot; the audio thread takes each slot written since its last look, once,
+    // so a burst of writes between blocks costs the block one update per parameter rather than one per write.
+    // a write racing with `Consume()` may be taken twice (now, and again next block), but is never lost
+    template<unsigned int numSlots>
+    class ParamStore {
+        static constexpr unsigned int numWords = (numSlots + 63) / 64;
+
+        std::atomic<float> values[numSlots]{};
+        std::atomic<uint64_t> dirty[numWords]{};
+
+    public:
+        void Write(unsigned int slot, float value) {
+            values[slot].store(value, std::memory_order_relaxed);
+            // publishing the bit releases the value
+            dirty[slot / 64].fetch_or(uint64_t(1) << (slot % 64), std::memory_order_release);
+        }
+
+        // call `f(slot, value)` for each slot written since the last call, in slot order
+        template<typename F>
+        void Consume(F &&f) {
+            for (unsigned int w = 0; w < numWords; ++w) {
+                uint64_t bits = dirty[w].exchange(0, std::memory_order_acquire);
+                while (bits != 0) {
+                    const auto slot = static_cast<unsigned int>(w * 64 + LowestSetBit(bits));
+                    f(slot, values[slot].load(std::memory_order_relaxed));
+                    bits &= bits - 1;
+                }
+            }
+        }
+    };
+
+}
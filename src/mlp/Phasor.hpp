@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Constants.hpp"
+#include "SampleFormat.hpp"
 #include "Types.hpp"
 
 namespace mlp {
@@ -21,7 +22,11 @@ namespace mlp {
     //------------------------------------------------
 // simplistic  phasor including crossfade
 // for now, just counts integer frames in one direction
+// fade phase and value are in the given number format (see SampleFormat.hpp)
+    template<typename Format = LoopFormat>
     struct FadePhasor {
+        typedef typename Format::Phase Phase;
+        typedef typename Format::Gain Gain;
 
         frame_t currentFrame{0};
         frame_t maxFrame{std::numeric_limits<frame_t>::max()};
@@ -29,9 +34,9 @@ namespace mlp {
         bool isFadingIn{false};
         bool isFadingOut{false};
         bool isActive{false};
-        float fadePhase{0.f};
-        float fadeIncrement{0.01f};
-        float fadeValue{0.f};
+        Phase fadePhase{};
+        Phase fadeIncrement{FromFloat<Phase>(0.01f)};
+        Gain fadeValue{};
 
         // return true if the phasor has wrapped
         PhasorAdvanceResult Advance() {
@@ -46,25 +51,25 @@ namespace mlp {
 
             if (isFadingIn) {
                 fadePhase += fadeIncrement;
-                if (fadePhase >= 1.f) {
-                    fadePhase = 1.f;
+                if (fadePhase >= Format::phaseOne) {
+                    fadePhase = Format::phaseOne;
                     isFadingIn = false;
-                    fadeValue = 1.f;
+                    fadeValue = Format::gainOne;
                     result.Set(PhasorAdvanceResultFlag::DONE_FADEIN);
                 } else {
-                    fadeValue = sinf(fadePhase * pi_2<float>);
+                    fadeValue = Format::FadeCurve(fadePhase);
                 }
             }
             if (isFadingOut) {
                 fadePhase -= fadeIncrement;
-                if (fadePhase <= 0.f) {
-                    fadePhase = 0.f;
-                    fadeValue = 0.f;
+                if (fadePhase <= Phase{}) {
+                    fadePhase = Phase{};
+                    fadeValue = Gain{};
                     isFadingOut = false;
                     isActive = false;
                     result.Set(PhasorAdvanceResultFlag::DONE_FADEOUT);
                 } else {
-                    fadeValue = sinf(fadePhase * pi_2<float>);
+                    fadeValue = Format::FadeCurve(fadePhase);
                 }
             }
             currentFrame++;
@@ -82,8 +87,8 @@ namespace mlp {
 
         void Reset(frame_t position = 0) {
             currentFrame = position;
-            fadePhase = 0.f;
-            fadeValue = 0.f;
+            fadePhase = Phase{};
+            fadeValue = Gain{};
             isFadingOut = false;
             isFadingIn = true;
             isActive = true;
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <math.h>
+
+#include "Constants.hpp"
+#include "Fixed.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // number formats for per-frame processing.
+    // each format names the types of audio samples, gains (levels, fades, switch levels),
+    // fade/switch phases and fractional frame counts, and supplies the few operations that differ between them.
+    // control-rate values (parameters, smoothing targets) stay in float, and are converted once per block or change
+
+    enum class SampleFormatId {
+        Float,
+        // Q1.31 audio, Q16.16 gains, Q2.30 phases; no floating-point math per frame
+        Fixed,
+        COUNT
+    };
+
+    static constexpr char SampleFormatIdLabel[static_cast<int>(SampleFormatId::COUNT)][16] = {
+            "FLOAT",
+            "FIXED"
+    };
+
+    template<SampleFormatId id>
+    struct SampleFormat;
+
+    template<>
+    struct SampleFormat<SampleFormatId::Float> {
+        typedef float Audio;
+        typedef float Gain;
+        typedef float Phase;
+        typedef float Frames;
+
+        static constexpr Gain gainOne = 1.f;
+        static constexpr Phase phaseOne = 1.f;
+
+        // quarter-cycle sine, for voice crossfades
+        static Gain FadeCurve(Phase phase) {
+            return sinf(phase * pi_2<float>);
+        }
+
+        // half-cycle raised cosine, for switches
+        static Gain SwitchCurve(Phase phase) {
+            return cosf((phase + 1.f) * pi<float>) * 0.5f + 0.5f;
+        }
+
+        // split a read offset into whole frames (rounded up), and the fraction back from there
+        static void SplitOffset(Frames offset, long int &offsetFrames, Gain &mu) {
+            offsetFrames = static_cast<long int>(ceilf(offset));
+            mu = static_cast<float>(offsetFrames) - offset;
+        }
+
+        static Audio Magnitude(Audio x) {
+            return fabsf(x);
+        }
+
+        // 4-point hermite interpolation between x0 and x1
+        static Audio Hermite(Audio xm1, Audio x0, Audio x1, Audio x2, Gain mu) {
+            const float c0 = x0;
+            const float c1 = 0.5f * (x1 - xm1);
+            const float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+            const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            return ((c3 * mu + c2) * mu + c1) * mu + c0;
+        }
+
+        template<typename Storage>
+        static Audio Load(const typename Storage::Element &e) {
+            return Storage::Load(e);
+        }
+
+        template<typename Storage>
+        static void Store(typename Storage::Element &e, Audio x, uint32_t &seed) {
+            Storage::Store(e, x, seed);
+        }
+    };
+
+    template<>
+    struct SampleFormat<SampleFormatId::Fixed> {
+        typedef q31 Audio;
+        typedef q16 Gain;
+        typedef q30 Phase;
+        typedef qframes Frames;
+
+        static constexpr Gain gainOne = Gain::FromRaw(q16::one);
+        static constexpr Phase phaseOne = Phase::FromRaw(q30::one);
+
+        // curves are tabulated over [0, 1] at startup, and interpolated linearly
+        static constexpr int tableBits = 8;
+        typedef std::array<int32_t, (1 << tableBits) + 1> CurveTable;
+
+        template<typename F>
+        static CurveTable MakeTable(F f) {
+            CurveTable table{};
+            for (int i = 0; i <= (1 << tableBits); ++i) {
+                table[i] = q16::FromFloat(f(static_cast<float>(i) / (1 << tableBits))).raw;
+            }
+            return table;
+        }
+
+        static inline const CurveTable fadeTable = MakeTable([](float x) { return sinf(x * pi_2<float>); });
+        static inline const CurveTable switchTable = MakeTable([](float x) { return 0.5f - 0.5f * cosf(x * pi<float>); });
+
+        static Gain LookUp(const CurveTable &table, Phase phase) {
+            if (phase.raw <= 0) return Gain::FromRaw(table.front());
+            if (phase.raw >= q30::one) return Gain::FromRaw(table.back());
+            constexpr int indexShift = q30::fractionBits - tableBits;
+            const int i = phase.raw >> indexShift;
+            // 16 bits of fraction between table points
+            const int32_t frac = (phase.raw >> (indexShift - 16)) & 0xffff;
+            return Gain::FromRaw(table[i] + static_cast<int32_t>((int64_t(table[i + 1] - table[i]) * frac) >> 16));
+        }
+
+        static Gain FadeCurve(Phase phase) {
+            return LookUp(fadeTable, phase);
+        }
+
+        static Gain SwitchCurve(Phase phase) {
+            return LookUp(switchTable, phase);
+        }
+
+        static void SplitOffset(Frames offset, long int &offsetFrames, Gain &mu) {
+            constexpr int64_t fractionMask = (int64_t(1) << qframes::fractionBits) - 1;
+            offsetFrames = static_cast<long int>((offset.raw + fractionMask) >> qframes::fractionBits);
+            mu = Gain::FromRaw(static_cast<int32_t>((int64_t(offsetFrames) << qframes::fractionBits) - offset.raw));
+        }
+
+        // saturates, since -1 has no positive counterpart
+        static Audio Magnitude(Audio x) {
+            return Audio::FromRaw(x.raw < 0 ? fixed::Saturate(-int64_t(x.raw)) : x.raw);
+        }
+
+        // as for float, with the coefficients in 64 bits, since they can exceed [-1, 1)
+        static Audio Hermite(Audio xm1, Audio x0, Audio x1, Audio x2, Gain mu) {
+            const int64_t c0 = x0.raw;
+            const int64_t c1 = (int64_t(x1.raw) - xm1.raw) / 2;
+            const int64_t c2 = xm1.raw - (int64_t(x0.raw) * 5) / 2 + int64_t(x1.raw) * 2 - x2.raw / 2;
+            const int64_t c3 = (int64_t(x2.raw) - xm1.raw) / 2 + ((int64_t(x0.raw) - x1.raw) * 3) / 2;
+            const int64_t m = mu.raw;
+            int64_t y = ((c3 * m) >> q16::fractionBits) + c2;
+            y = ((y * m) >> q16::fractionBits) + c1;
+            y = ((y * m) >> q16::fractionBits) + c0;
+            return Audio::FromRaw(fixed::Saturate(y));
+        }
+
+        // only integer storage converts without floating-point math
+        template<typename Storage>
+        static Audio Load(const typename Storage::Element &e) {
+            static_assert(Storage::isInteger, "the fixed-point format needs integer loop storage (Int24 or Int16)");
+            return Storage::LoadFixed(e);
+        }
+
+        template<typename Storage>
+        static void Store(typename Storage::Element &e, Audio x, uint32_t &seed) {
+            static_assert(Storage::isInteger, "the fixed-point format needs integer loop storage (Int24 or Int16)");
+            Storage::StoreFixed(e, x, seed);
+        }
+    };
+
+    /// processing format for the whole engine, chosen at compile time, e.g. -DMLP_SAMPLE_FORMAT=Fixed
+#ifndef MLP_SAMPLE_FORMAT
+#define MLP_SAMPLE_FORMAT Float
+#endif
+    typedef SampleFormat<SampleFormatId::MLP_SAMPLE_FORMAT> LoopFormat;
+    // type of audio samples going in and out of the engine
+    typedef LoopFormat::Audio AudioSample;
+
+}
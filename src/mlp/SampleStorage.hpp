@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <math.h>
+#include <type_traits>
+
+#include "Fixed.hpp"
+#include "SampleFormat.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // sample formats for loop buffers.
+    // each storage type has an `Element`, and converts to and from float one sample at a time.
+    // the integer formats clip at [-1, 1], and also convert to and from Q1.31, for the fixed-point build
+
+    enum class SampleStorageId {
+        Float32,
+        // IEEE half precision; about 11 bits of precision at any level
+        Float16,
+        // signed 24-bit, packed into 3 bytes
+        Int24,
+        // signed 16-bit, with triangular dither
+        Int16,
+        COUNT
+    };
+
+    static constexpr char SampleStorageIdLabel[static_cast<int>(SampleStorageId::COUNT)][16] = {
+            "FLOAT32",
+            "FLOAT16",
+            "INT24",
+            "INT16"
+    };
+
+    template<SampleStorageId id>
+    struct SampleStorage;
+
+    template<>
+    struct SampleStorage<SampleStorageId::Float32> {
+        typedef float Element;
+        static constexpr bool isInteger = false;
+
+        static float Load(const Element &e) {
+            return e;
+        }
+
+        static void Store(Element &e, float x, uint32_t &) {
+            e = x;
+        }
+    };
+
+    template<>
+    struct SampleStorage<SampleStorageId::Float16> {
+        typedef uint16_t Element;
+        static constexpr bool isInteger = false;
+
+        static float Load(const Element &e) {
+            const uint32_t sign = static_cast<uint32_t>(e & 0x8000) << 16;
+            const uint32_t exponent = (e >> 10) & 0x1f;
+            const uint32_t mantissa = e & 0x3ff;
+            if (exponent == 0) {
+                // zero or subnormal
+                const float x = static_cast<float>(mantissa) * 5.9604645e-8f;
+                return sign ? -x : x;
+            }
+            uint32_t bits;
+            if (exponent == 0x1f) {
+                bits = sign | 0x7f800000 | (mantissa << 13);
+            } else {
+                bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+            }
+            float x;
+            std::memcpy(&x, &bits, sizeof(x));
+            return x;
+        }
+
+        // largest finite half
+        static constexpr float maxValue = 65504.f;
+
+        // round to nearest even
+        static void Store(Element &e, float x, uint32_t &) {
+            if (x > maxValue) x = maxValue;
+            if (x < -maxValue) x = -maxValue;
+            uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            const uint32_t sign = (bits >> 16) & 0x8000;
+            bits &= 0x7fffffff;
+            uint32_t h;
+            if (bits < 0x38800000) {
+                // below the smallest normal half: let a float add do the rounding into a subnormal
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                f += 0.5f;
+                std::memcpy(&h, &f, sizeof(h));
+                h -= 0x3f000000;
+            } else if (bits > 0x7f800000) {
+                // NaN
+                h = 0;
+            } else {
+                const uint32_t isOdd = (bits >> 13) & 1;
+                bits += 0xc8000fff + isOdd;
+                h = bits >> 13;
+            }
+            e = static_cast<Element>(sign | h);
+        }
+    };
+
+    template<>
+    struct SampleStorage<SampleStorageId::Int24> {
+        struct Element {
+            uint8_t b[3];
+        };
+        static constexpr bool isInteger = true;
+
+        static constexpr float scale = 8388608.f;
+
+        static float Load(const Element &e) {
+            const uint32_t u = static_cast<uint32_t>(e.b[0])
+                               | (static_cast<uint32_t>(e.b[1]) << 8)
+                               | (static_cast<uint32_t>(e.b[2]) << 16);
+            // sign-extend from 24 bits
+            const auto i = static_cast<int32_t>(u << 8) >> 8;
+            return static_cast<float>(i) * (1.f / scale);
+        }
+
+        static void Store(Element &e, float x, uint32_t &) {
+            float s = x * scale;
+            if (!(s > -scale)) s = -scale;
+            if (s > scale - 1.f) s = scale - 1.f;
+            const auto u = static_cast<uint32_t>(static_cast<int32_t>(lrintf(s)));
+            e.b[0] = static_cast<uint8_t>(u);
+            e.b[1] = static_cast<uint8_t>(u >> 8);
+            e.b[2] = static_cast<uint8_t>(u >> 16);
+        }
+
+        static q31 LoadFixed(const Element &e) {
+            const uint32_t u = static_cast<uint32_t>(e.b[0])
+                               | (static_cast<uint32_t>(e.b[1]) << 8)
+                               | (static_cast<uint32_t>(e.b[2]) << 16);
+            return q31::FromRaw(static_cast<int32_t>(u << 8));
+        }
+
+        static void StoreFixed(Element &e, q31 x, uint32_t &) {
+            // round to nearest, clipping at the top
+            const auto u = static_cast<uint32_t>(fixed::Saturate((int64_t(x.raw) + 0x80) & ~int64_t(0xff)) >> 8);
+            e.b[0] = static_cast<uint8_t>(u);
+            e.b[1] = static_cast<uint8_t>(u >> 8);
+            e.b[2] = static_cast<uint8_t>(u >> 16);
+        }
+    };
+
+    template<>
+    struct SampleStorage<SampleStorageId::Int16> {
+        typedef int16_t Element;
+        static constexpr bool isInteger = true;
+
+        static constexpr float scale = 32768.f;
+
+        static float Load(const Element &e) {
+            return static_cast<float>(e) * (1.f / scale);
+        }
+
+        // dither state is a per-writer random seed
+        static void Store(Element &e, float x, uint32_t &seed) {
+            float s = x * scale;
+            // samples already on the grid (e.g. preserved at unity) are left alone,
+            // so that overdubbing silence doesn't add a fresh layer of noise on every pass
+            if (s != rintf(s)) {
+                s += Random(seed) - Random(seed);
+            }
+            if (!(s > -scale)) s = -scale;
+            if (s > scale - 1.f) s = scale - 1.f;
+            e = static_cast<Element>(lrintf(s));
+        }
+
+        static q31 LoadFixed(const Element &e) {
+            return q31::FromRaw(static_cast<int32_t>(static_cast<uint32_t>(e) << 16));
+        }
+
+        // as for float, with the dither in units of 2^-16 of the 16-bit step
+        static void StoreFixed(Element &e, q31 x, uint32_t &seed) {
+            int64_t s = x.raw;
+            if ((s & 0xffff) != 0) {
+                s += int64_t(RandomFixed(seed)) - RandomFixed(seed);
+            }
+            s = fixed::Saturate((s + 0x8000) & ~int64_t(0xffff));
+            e = static_cast<Element>(s >> 16);
+        }
+
+    private:
+        // uniform in [0, 1)
+        static float Random(uint32_t &seed) {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<float>(seed >> 8) * (1.f / 16777216.f);
+        }
+
+        // uniform in [0, 65536)
+        static int32_t RandomFixed(uint32_t &seed) {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<int32_t>(seed >> 16);
+        }
+    };
+
+    /// storage format for all loop buffers, chosen at compile time, e.g. -DMLP_LOOP_STORAGE=Int16.
+    /// by default, Float32, or Int24 for the fixed-point build
+#ifdef MLP_LOOP_STORAGE
+    typedef SampleStorage<SampleStorageId::MLP_LOOP_STORAGE> LoopStorage;
+#else
+    typedef std::conditional<std::is_same<AudioSample, float>::value,
+            SampleStorage<SampleStorageId::Float32>, SampleStorage<SampleStorageId::Int24>>::type LoopStorage;
+#endif
+    typedef LoopStorage::Element LoopSample;
+
+}
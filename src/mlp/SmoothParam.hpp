@@ -0,0 +1,159 @@
+#pragma once
+
+#include <math.h>
+
+#include "Constants.hpp"
+#include "Fixed.hpp"
+
+namespace mlp {
+
+    enum class SmoothParamMode {
+        // exponential approach to the target, with time constant = smoothing time
+        OnePole,
+        // constant-rate ramp, reaching the target after the smoothing time
+        Linear,
+        // constant-rate ramp in the log domain (for gains), reaching the target after the smoothing time
+        Exponential,
+        COUNT
+    };
+
+    //----------------------------------------
+    // smoothed scalar parameter, updated at block rate.
+    // at the start of each (sub-)block, the smoother computes where the value should be at the block's end,
+    // and the value ramps linearly to that point over the block's frames.
+    // a settled parameter holds a constant value and can skip the ramp entirely.
+    // the per-frame value and increment have type T (e.g. a fixed-point gain); all other math is in float
+    template<typename T = float>
+    struct SmoothParam {
+        // values below this are treated as silence in exponential mode
+        static constexpr float expFloor = 1e-4f;
+        // distance from the target at which the smoother snaps to it
+        static constexpr float snapThreshold = 1e-5f;
+
+        SmoothParamMode mode{SmoothParamMode::OnePole};
+        // current per-frame value
+        T value{};
+        // value at the end of the current block's ramp
+        float blockEnd{0.f};
+        // requested value
+        float target{0.f};
+        // per-frame increment for the current block
+        T delta{};
+        // smoothing time, in frames
+        float timeFrames{1.f};
+        // per-frame increment for linear/exponential ramps, set when the target changes
+        float rampRate{0.f};
+        // true when value == target, and no per-frame update is needed
+        bool isSettled{true};
+
+        explicit SmoothParam(float initialValue = 0.f) {
+            SetImmediate(initialValue);
+        }
+
+        void SetImmediate(float aValue) {
+            blockEnd = target = aValue;
+            value = FromFloat<T>(aValue);
+            delta = T{};
+            isSettled = true;
+        }
+
+        void SetTarget(float aTarget) {
+            target = aTarget;
+            if (target == blockEnd) {
+                return;
+            }
+            UpdateRampRate();
+            isSettled = false;
+        }
+
+        void SetTime(float frames) {
+            timeFrames = frames > 1.f ? frames : 1.f;
+            UpdateRampRate();
+        }
+
+        void SetMode(SmoothParamMode aMode) {
+            mode = aMode;
+            UpdateRampRate();
+        }
+
+        // call once per (sub-)block, before advancing any of its frames
+        void BeginBlock(unsigned int numFrames) {
+            // snap to the end of the last ramp, in case not all frames were advanced
+            const float start = blockEnd;
+            value = FromFloat<T>(start);
+            if (isSettled || numFrames == 0) {
+                delta = T{};
+                return;
+            }
+            const auto n = static_cast<float>(numFrames);
+            float next;
+            switch (mode) {
+                case SmoothParamMode::Linear:
+                    next = start + (target > start ? rampRate : -rampRate) * n;
+                    if ((target - start) * (target - next) <= 0.f) {
+                        next = target;
+                    }
+                    break;
+                case SmoothParamMode::Exponential: {
+                    float from = start > expFloor ? start : expFloor;
+                    float to = target > expFloor ? target : expFloor;
+                    next = from * expf((to > from ? rampRate : -rampRate) * n);
+                    if ((to - from) * (to - next) <= 0.f) {
+                        next = target;
+                    }
+                    break;
+                }
+                case SmoothParamMode::OnePole:
+                case SmoothParamMode::COUNT:
+                default:
+                    next = target + (start - target) * expf(-n / timeFrames);
+                    break;
+            }
+            if (fabsf(target - next) < snapThreshold) {
+                next = target;
+            }
+            blockEnd = next;
+            delta = FromFloat<T>((blockEnd - start) / n);
+            if (blockEnd == target) {
+                // this is the last ramp; settle at the start of the next block
+                isSettled = true;
+            }
+        }
+
+        // call once per frame
+        void Advance() {
+            value += delta;
+        }
+
+        T Get() const {
+            return value;
+        }
+
+        // true if the value is constant over the current block
+        bool IsConstant() const {
+            return delta == T{};
+        }
+
+    private:
+        void UpdateRampRate() {
+            switch (mode) {
+                case SmoothParamMode::Linear:
+                    rampRate = fabsf(target - blockEnd) / timeFrames;
+                    break;
+                case SmoothParamMode::Exponential: {
+                    float from = blockEnd > expFloor ? blockEnd : expFloor;
+                    float to = target > expFloor ? target : expFloor;
+                    // log-domain increment per frame
+                    rampRate = fabsf(logf(to / from)) / timeFrames;
+                    break;
+                }
+                case SmoothParamMode::OnePole:
+                case SmoothParamMode::COUNT:
+                default:
+                    rampRate = 0.f;
+                    break;
+            }
+        }
+    };
+
+}
@@ -3,39 +3,45 @@
 #include <math.h>
 
 #include "Constants.hpp"
+#include "SampleFormat.hpp"
 
 namespace mlp {
 
 //----------------------------------------
 // simple smoother/fader class with a binary logical value
+// phase and level are in the given number format (see SampleFormat.hpp)
+    template<typename Format = LoopFormat>
     struct SmoothSwitch {
+        typedef typename Format::Phase Phase;
+        typedef typename Format::Gain Gain;
+
         // true when the switch is logically open
         bool isOpen{false};
         // true when an up/down fade is in progress
         bool isSwitching{false};
         // linear phase in [0, 1]
-        float phase{0.f};
+        Phase phase{};
         // actual output value (likely nonlinear)
-        float level{0.f};
+        Gain level{};
         // per-sample phase delta
-        float delta{0.01f};
+        Phase delta{FromFloat<Phase>(0.01f)};
         // signed delta, depends on fade direction
-        float sdelta{};
+        Phase sdelta{};
 
         void UpdateLevel()
         {
             if (isSwitching) {
                 //--------------------------------
-                /// could use different curves here, or LUT, or...
+                /// could use different curves here...
 
                 // quarter-cycle sine:
-                // return sinf(phase * pi_2<float>);
+                // level = Format::FadeCurve(phase);
 
                 // half-cycle raised cosine:
-                level = cosf((phase + 1.f) * pi<float>) * 0.5f + 0.5f;
+                level = Format::SwitchCurve(phase);
                 //--------------------------------
             } else {
-                level = isOpen ? 1.f : 0.f;
+                level = isOpen ? Format::gainOne : Gain{};
             }
 
         }
@@ -70,11 +76,11 @@ namespace mlp {
                 return IsActive();
             }
             phase += sdelta;
-            if (phase >= 1.f) {
-                phase = 1.f;
+            if (phase >= Format::phaseOne) {
+                phase = Format::phaseOne;
                 isSwitching = false;
-            } else if (phase <= 0.f) {
-                phase = 0.f;
+            } else if (phase <= Phase{}) {
+                phase = Phase{};
                 isSwitching = false;
             }
             UpdateLevel();
@@ -86,7 +92,7 @@ namespace mlp {
         }
 
         void SetDelta(float d) {
-            delta = d;
+            delta = FromFloat<Phase>(d);
             sdelta = isOpen ? delta : -delta;
         }
     };
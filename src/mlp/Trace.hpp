@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "readerwriterqueue/readerwriterqueue.h"
+
+#include "Types.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // one record of what the kernel did, and when (in frames since startup)
+    struct TraceEvent {
+        enum class Kind : uint8_t {
+            // a condition fired on a layer
+            Condition,
+            // a binding performed an action on a target layer
+            Action,
+            // a block was processed
+            Block,
+        };
+
+        frame_t time{0};
+        Kind kind{Kind::Condition};
+        // layer on which the condition fired, or which the action came from
+        uint8_t layer{0};
+        // layer on which the action was performed
+        uint8_t target{0};
+        // LayerConditionId or LayerActionId
+        uint8_t id{0};
+        // current voice of the layer on which the condition fired, or of the action's target (before the action)
+        uint8_t voice{0};
+        // firings left on the binding after this one (negative is unlimited)
+        int32_t counter{-1};
+        // block length, in frames
+        uint32_t frames{0};
+        // time spent processing the block, in nanoseconds
+        uint32_t cpuNanoseconds{0};
+    };
+
+    //------------------------------------------------
+    // fixed-size, lock-free trace ring.
+    // written only by the audio thread, and read only by one exporter thread.
+    // all storage is allocated up front; when the ring is full, new events are dropped and counted
+    class Trace {
+    public:
+        static constexpr size_t capacity = 1 << 14;
+
+    private:
+        moodycamel::ReaderWriterQueue<TraceEvent> queue{capacity};
+        std::atomic<bool> enabled{false};
+        std::atomic<unsigned int> dropped{0};
+
+        void Push(const TraceEvent &event) {
+            if (!queue.try_enqueue(event)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+    public:
+        //--- control thread
+        void SetEnabled(bool aEnabled) {
+            enabled.store(aEnabled, std::memory_order_relaxed);
+        }
+
+        bool IsEnabled() const {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        //--- audio thread
+        // times are the frame on which the condition fired
+        void Condition(frame_t time, unsigned int layer, unsigned int condition, unsigned int voice) {
+            TraceEvent event;
+            event.time = time;
+            event.kind = TraceEvent::Kind::Condition;
+            event.layer = static_cast<uint8_t>(layer);
+            event.target = static_cast<uint8_t>(layer);
+            event.id = static_cast<uint8_t>(condition);
+            event.voice = static_cast<uint8_t>(voice);
+            Push(event);
+        }
+
+        void Action(frame_t time, unsigned int layer, unsigned int target, unsigned int action, unsigned int voice,
+                    int counter) {
+            TraceEvent event;
+            event.time = time;
+            event.kind = TraceEvent::Kind::Action;
+            event.layer = static_cast<uint8_t>(layer);
+            event.target = static_cast<uint8_t>(target);
+            event.id = static_cast<uint8_t>(action);
+            event.voice = static_cast<uint8_t>(voice);
+            event.counter = counter;
+            Push(event);
+        }
+
+        void Block(frame_t startTime, unsigned int numFrames, unsigned long long cpuNanoseconds) {
+            TraceEvent event;
+            event.time = startTime;
+            event.kind = TraceEvent::Kind::Block;
+            event.frames = numFrames;
+            event.cpuNanoseconds = cpuNanoseconds > UINT32_MAX
+                                   ? UINT32_MAX : static_cast<uint32_t>(cpuNanoseconds);
+            Push(event);
+        }
+
+        //--- exporter thread
+        bool Read(TraceEvent &event) {
+            return queue.try_dequeue(event);
+        }
+
+        // number of events dropped since the last call
+        unsigned int TakeDroppedCount() {
+            return dropped.exchange(0, std::memory_order_relaxed);
+        }
+    };
+
+}
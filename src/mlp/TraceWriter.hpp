@@ -0,0 +1,113 @@
+#pragma once
+
+#include <iomanip>
+#include <ostream>
+
+#include "Constants.hpp"
+#include "LayerBehavior.hpp"
+#include "Trace.hpp"
+
+namespace mlp {
+
+    //------------------------------------------------
+    // writes trace events as Chrome trace JSON (also loaded by Perfetto and about:tracing).
+    // each layer gets its own track of conditions and actions, and processed blocks go on a separate track,
+    // with CPU time per block as a counter.
+    // timestamps are in microseconds of *sample* time, so cascades line up with the audio
+    class TraceWriter {
+        std::ostream &out;
+        double microsecondsPerFrame;
+        bool isFirstEvent{true};
+
+        static constexpr unsigned int blockTrack = numLoopLayers;
+
+        void BeginEvent() {
+            out << (isFirstEvent ? "\n" : ",\n");
+            isFirstEvent = false;
+        }
+
+        double Timestamp(frame_t time) const {
+            return static_cast<double>(time) * microsecondsPerFrame;
+        }
+
+        void WriteTrackName(unsigned int track, const char *name, unsigned int index) {
+            BeginEvent();
+            out << R"({"name":"thread_name","ph":"M","pid":0,"tid":)" << track
+                << R"(,"args":{"name":")" << name;
+            if (index < numLoopLayers) {
+                out << " " << index;
+            }
+            out << "\"}}";
+        }
+
+    public:
+        TraceWriter(std::ostream &aOut, double sampleRate) :
+                out(aOut), microsecondsPerFrame(1e6 / sampleRate) {}
+
+        void Begin() {
+            // fixed point, so that long traces keep sub-microsecond timestamps
+            out << std::fixed << std::setprecision(3);
+            out << "[";
+            for (unsigned int i = 0; i < numLoopLayers; ++i) {
+                WriteTrackName(i, "layer", i);
+            }
+            WriteTrackName(blockTrack, "blocks", numLoopLayers);
+        }
+
+        void Write(const TraceEvent &event) {
+            const double ts = Timestamp(event.time);
+            switch (event.kind) {
+                case TraceEvent::Kind::Condition:
+                    if (event.id >= static_cast<uint8_t>(LayerConditionId::NUM_CONDITIONS)) {
+                        return;
+                    }
+                    BeginEvent();
+                    out << R"({"name":")" << LayerConditionIdLabel[event.id]
+                        << R"(","cat":"condition","ph":"i","s":"t","pid":0,"tid":)" << (int) event.layer
+                        << R"(,"ts":)" << ts
+                        << R"(,"args":{"frame":)" << event.time
+                        << R"(,"voice":)" << (int) event.voice << "}}";
+                    break;
+                case TraceEvent::Kind::Action:
+                    if (event.id >= static_cast<uint8_t>(LayerActionId::NUM_ACTIONS)) {
+                        return;
+                    }
+                    BeginEvent();
+                    out << R"({"name":")" << LayerActionIdLabel[event.id]
+                        << R"(","cat":"action","ph":"i","s":"t","pid":0,"tid":)" << (int) event.target
+                        << R"(,"ts":)" << ts
+                        << R"(,"args":{"frame":)" << event.time
+                        << R"(,"source":)" << (int) event.layer
+                        << R"(,"voice":)" << (int) event.voice
+                        << R"(,"counter":)" << event.counter << "}}";
+                    break;
+                case TraceEvent::Kind::Block:
+                    BeginEvent();
+                    out << R"({"name":"block","cat":"block","ph":"X","pid":0,"tid":)" << blockTrack
+                        << R"(,"ts":)" << ts
+                        << R"(,"dur":)" << static_cast<double>(event.frames) * microsecondsPerFrame
+                        << R"(,"args":{"frame":)" << event.time
+                        << R"(,"frames":)" << event.frames
+                        << R"(,"cpu_us":)" << static_cast<double>(event.cpuNanoseconds) * 1e-3 << "}}";
+                    BeginEvent();
+                    out << R"({"name":"cpu_us","ph":"C","pid":0,"ts":)" << ts
+                        << R"(,"args":{"cpu_us":)" << static_cast<double>(event.cpuNanoseconds) * 1e-3 << "}}";
+                    break;
+            }
+        }
+
+        // note events lost to a full trace ring, at the given time
+        void WriteDropped(frame_t time, unsigned int count) {
+            BeginEvent();
+            out << R"({"name":"dropped","cat":"trace","ph":"i","s":"g","pid":0,"tid":)" << blockTrack
+                << R"(,"ts":)" << Timestamp(time)
+                << R"(,"args":{"count":)" << count << "}}";
+        }
+
+        void End() {
+            out << "\n]\n";
+            out.flush();
+        }
+    };
+
+}
@@ -1,10 +1,38 @@
 #pragma once
 
 #include <bitset>
+#include <cstdint>
 
 namespace mlp {
     typedef unsigned long int frame_t;
 
+    // index of the lowest set bit in a nonzero mask
+    inline unsigned int LowestSetBit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned int>(__builtin_ctz(mask));
+#else
+        unsigned int i = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            ++i;
+        }
+        return i;
+#endif
+    }
+
+    inline unsigned int LowestSetBit(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned int>(__builtin_ctzll(mask));
+#else
+        unsigned int i = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            ++i;
+        }
+        return i;
+#endif
+    }
+
     // silly syntax sweetener for indexing bitfields by enum class values
     template<typename IdClass, IdClass Count>
     struct BitSet {
@@ -18,6 +46,10 @@ namespace mlp {
             flags.reset(static_cast<size_t>(flag));
         }
 
+        void Merge(const BitSet &other) {
+            flags |= other.flags;
+        }
+
         bool Test(IdClass flag) const {
             return flags.test(static_cast<size_t>(flag));
         }
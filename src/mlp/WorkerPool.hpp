@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace mlp {
+
+    //------------------------------------------------
+    // a small pool of worker threads for splitting audio-thread work into independent tasks.
+    // the calling thread runs tasks too, and `Run()` returns only when every task has finished,
+    // so the pool can be used inside a device callback.
+    // idle workers spin, then yield, and only sleep after a longer quiet period;
+    // waking sleeping workers takes a lock, which should only happen on the first block after a pause.
+    class WorkerPool {
+    public:
+        // spin iterations before yielding, and yields before sleeping
+        static constexpr unsigned int spinCount = 4096;
+        static constexpr unsigned int yieldCount = 65536;
+
+        typedef void (*TaskFunction)(void *context, unsigned int taskIndex);
+
+        static constexpr unsigned int maxTasks = (1u << 16) - 1;
+
+        WorkerPool() = default;
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        ~WorkerPool() {
+            Stop();
+        }
+
+        // start the given number of worker threads, in addition to the caller.
+        // if `firstCore` is non-negative, worker k is pinned to core (firstCore + k), wrapping at the core count.
+        // if `priority` is positive, workers request realtime (FIFO) scheduling at that priority
+        void Start(unsigned int numWorkersToStart, int firstCore = -1, int priority = 0) {
+            Stop();
+            shouldStop.store(false);
+            const unsigned int numCores = std::thread::hardware_concurrency();
+            for (unsigned int k = 0; k < numWorkersToStart; ++k) {
+                threads.emplace_back([this] { WorkLoop(); });
+                if (firstCore >= 0 && numCores > 0) {
+                    Pin(threads.back(), (static_cast<unsigned int>(firstCore) + k) % numCores);
+                }
+                if (priority > 0) {
+                    SetPriority(threads.back(), priority);
+                }
+            }
+            numWorkers.store(numWorkersToStart);
+        }
+
+        // (a `Run()` in progress on another thread still finishes, on that thread if need be)
+        void Stop() {
+            if (threads.empty()) {
+                return;
+            }
+            numWorkers.store(0);
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                shouldStop.store(true);
+            }
+            sleepCondition.notify_all();
+            for (auto &t: threads) {
+                t.join();
+            }
+            threads.clear();
+        }
+
+        unsigned int GetNumWorkers() const {
+            return numWorkers.load(std::memory_order_relaxed);
+        }
+
+        // run `f(i)` for each i in [0, numTasks), on the workers and the calling thread.
+        // tasks may run in any order, and on any thread. at most `maxTasks` at once
+        template<typename F>
+        void Run(unsigned int numTasks, F &f) {
+            assert(numTasks <= maxTasks);
+            if (numTasks == 0) {
+                return;
+            }
+            if (GetNumWorkers() == 0 || numTasks == 1) {
+                for (unsigned int i = 0; i < numTasks; ++i) {
+                    f(i);
+                }
+                return;
+            }
+            taskFunction.store([](void *context, unsigned int i) { (*static_cast<F *>(context))(i); },
+                               std::memory_order_relaxed);
+            taskContext.store(&f, std::memory_order_relaxed);
+            remaining.store(numTasks, std::memory_order_relaxed);
+            // publishing the new generation (with the task count) releases the job to the workers.
+            // (sequentially consistent, so that either a worker going to sleep sees the new job, or we see it sleeping)
+            const uint64_t generation = (claim.load(std::memory_order_relaxed) >> 32) + 1;
+            claim.store((generation << 32) | (uint64_t(numTasks) << countShift));
+            if (numSleeping.load() > 0) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                sleepCondition.notify_all();
+            }
+            while (RunOneTask(generation)) {}
+            while (remaining.load(std::memory_order_acquire) > 0) {}
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        // number of running workers, which may be read from the audio thread
+        std::atomic<unsigned int> numWorkers{0};
+        // job generation in the upper 32 bits, then the job's task count, then the next task index.
+        // tagging claims with the generation stops a slow worker from taking a task from the next job,
+        // and keeping the count in the same word stops it from checking its claim against the next job's count
+        static constexpr unsigned int countShift = 16;
+        static constexpr uint64_t indexMask = (uint64_t(1) << countShift) - 1;
+        static_assert(maxTasks <= indexMask, "task indices must fit below the count");
+        std::atomic<uint64_t> claim{0};
+        std::atomic<TaskFunction> taskFunction{nullptr};
+        std::atomic<void *> taskContext{nullptr};
+        std::atomic<unsigned int> remaining{0};
+
+        std::mutex sleepMutex;
+        std::condition_variable sleepCondition;
+        std::atomic<unsigned int> numSleeping{0};
+        std::atomic<bool> shouldStop{false};
+
+        // claim and run one task of the given job; returns false when there are none left
+        bool RunOneTask(uint64_t generation) {
+            uint64_t c = claim.load(std::memory_order_acquire);
+            while (true) {
+                if ((c >> 32) != generation) {
+                    return false;
+                }
+                const auto index = static_cast<unsigned int>(c & indexMask);
+                if (index >= static_cast<unsigned int>((c >> countShift) & indexMask)) {
+                    return false;
+                }
+                if (claim.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    taskFunction.load(std::memory_order_relaxed)(taskContext.load(std::memory_order_relaxed), index);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        void WorkLoop() {
+            uint64_t lastGeneration = claim.load(std::memory_order_acquire) >> 32;
+            unsigned int idleCount = 0;
+            while (!shouldStop.load(std::memory_order_relaxed)) {
+                const uint64_t generation = claim.load(std::memory_order_acquire) >> 32;
+                if (generation != lastGeneration) {
+                    lastGeneration = generation;
+                    idleCount = 0;
+                    while (RunOneTask(generation)) {}
+                    continue;
+                }
+                if (++idleCount < spinCount) {
+                    continue;
+                }
+                if (idleCount < spinCount + yieldCount) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                numSleeping.fetch_add(1);
+                sleepCondition.wait(lock, [&] {
+                    return shouldStop.load() || (claim.load() >> 32) != lastGeneration;
+                });
+                numSleeping.fetch_sub(1);
+                idleCount = 0;
+            }
+        }
+
+        static void Pin(std::thread &t, unsigned int core) {
+#if defined(__linux__)
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(core, &cpus);
+            if (pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus) != 0) {
+                std::cerr << "[WorkerPool] couldn't pin worker to core " << core << std::endl;
+            }
+#else
+            // no portable affinity API here; leave placement to the scheduler
+            (void) t;
+            (void) core;
+#endif
+        }
+
+        static void SetPriority(std::thread &t, int priority) {
+#if defined(__linux__) || defined(__APPLE__)
+            sched_param param{};
+            param.sched_priority = priority;
+            if (pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param) != 0) {
+                std::cerr << "[WorkerPool] couldn't set realtime priority" << std::endl;
+            }
+#else
+            (void) t;
+            (void) priority;
+#endif
+        }
+    };
+
+}
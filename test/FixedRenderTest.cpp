@@ -0,0 +1,109 @@
+// renders a fixed input and event script with the fixed-point format,
+// and compares the output bit for bit with a stored reference render.
+//
+// usage: fixed-render-test <reference file> [--update]
+// the reference is the interleaved Q1.31 output, as little-endian 32-bit integers.
+// `--update` rewrites it; only do that for a deliberate change to the output
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include "TestRender.hpp"
+
+static_assert(std::is_same<mlp::AudioSample, mlp::q31>::value, "build with MLP_SAMPLE_FORMAT=Fixed");
+
+using namespace test;
+
+static constexpr frame_t numFrames = 8192;
+
+// record a loop, overdub it, and move every continuous parameter that touches the per-frame path
+static std::vector<Event> MakeScript() {
+    return {
+            {256, [](Mlp &m) { m.Tap(Mlp::TapId::Set); }},
+            {1536, [](Mlp &m) { m.Tap(Mlp::TapId::Set); }},
+            {3072, [](Mlp &m) { m.FloatParamChange(Mlp::FloatParamId::PlaybackLevel, 0.3f); }},
+            {4096, [](Mlp &m) { m.FloatParamChange(Mlp::FloatParamId::Pan, 0.8f); }},
+            {5120, [](Mlp &m) { m.FloatParamChange(Mlp::FloatParamId::ReadOffset, 0.0123f); }},
+            {6144, [](Mlp &m) {
+                m.FloatParamChange(Mlp::FloatParamId::PreserveLevel, 0.5f);
+                m.Tap(Mlp::TapId::Set);
+            }},
+            {7168, [](Mlp &m) { m.Tap(Mlp::TapId::Stop); }},
+    };
+}
+
+static bool Read(const char *path, std::vector<int32_t> &samples) {
+    FILE *file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint8_t bytes[4];
+    while (std::fread(bytes, 1, 4, file) == 4) {
+        samples.push_back(static_cast<int32_t>(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16)
+                                               | (static_cast<uint32_t>(bytes[3]) << 24)));
+    }
+    std::fclose(file);
+    return true;
+}
+
+static bool Write(const char *path, const std::vector<AudioSample> &samples) {
+    FILE *file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool isOk = true;
+    for (const auto x: samples) {
+        const auto u = static_cast<uint32_t>(x.raw);
+        const uint8_t bytes[4] = {static_cast<uint8_t>(u), static_cast<uint8_t>(u >> 8),
+                                  static_cast<uint8_t>(u >> 16), static_cast<uint8_t>(u >> 24)};
+        isOk = isOk && std::fwrite(bytes, 1, 4, file) == 4;
+    }
+    return std::fclose(file) == 0 && isOk;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <reference file> [--update]" << std::endl;
+        return 2;
+    }
+    const std::vector<AudioSample> output = Render(MakeScript(), numFrames, 64);
+
+    if (argc > 2 && std::strcmp(argv[2], "--update") == 0) {
+        if (!Write(argv[1], output)) {
+            std::cerr << "can't write " << argv[1] << std::endl;
+            return 1;
+        }
+        std::cout << "wrote " << output.size() << " samples to " << argv[1] << std::endl;
+        return 0;
+    }
+
+    std::vector<int32_t> reference;
+    if (!Read(argv[1], reference)) {
+        std::cerr << "can't read " << argv[1] << std::endl;
+        return 1;
+    }
+    if (reference.size() != output.size()) {
+        std::cerr << "reference has " << reference.size() << " samples; rendered " << output.size() << std::endl;
+        return 1;
+    }
+    unsigned int numDifferent = 0;
+    for (size_t i = 0; i < output.size(); ++i) {
+        if (output[i].raw != reference[i]) {
+            if (numDifferent == 0) {
+                std::cerr << "first difference at frame " << i / numLoopChannels << ", channel "
+                          << i % numLoopChannels << ": " << output[i].raw << " (expected " << reference[i] << ")"
+                          << std::endl;
+            }
+            numDifferent++;
+        }
+    }
+    if (numDifferent > 0) {
+        std::cerr << numDifferent << " of " << output.size() << " samples differ from the reference" << std::endl;
+        return 1;
+    }
+    std::cout << "output matches the reference (" << output.size() << " samples)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,138 @@
+// round-trips pages through the loop page codec (see LayerCompressor.hpp) in every storage format,
+// and checks that each comes back bit for bit, within the encoded size the codec promises
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mlp/LayerCompressor.hpp"
+#include "mlp/SampleStorage.hpp"
+
+using namespace mlp;
+
+enum class Pattern : int {
+    Silence,
+    // random bit patterns, the worst case for the codec
+    Noise,
+    // small steps up and down, wrapping through the sample's full range
+    Walk,
+    // jumps between zero, all ones and the sign bit, the largest differences there are
+    Extremes,
+    // a triangle wave through the format's own conversion from float
+    Audio,
+    Count
+};
+
+static constexpr char PatternLabel[static_cast<int>(Pattern::Count)][16] = {
+        "silence",
+        "noise",
+        "walk",
+        "extremes",
+        "audio"
+};
+
+static uint32_t Random(uint32_t &seed) {
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+template<typename Storage>
+static void MakePage(Pattern pattern, typename Storage::Element *dst, size_t numSamples, uint32_t &seed) {
+    typedef typename Storage::Element Element;
+    static constexpr uint32_t extremes[] = {0u, ~0u, 0x80000000u >> (32 - sizeof(Element) * 8), 0u};
+    uint32_t bits = 0;
+    for (size_t i = 0; i < numSamples; ++i) {
+        switch (pattern) {
+            case Pattern::Silence:
+                bits = 0;
+                break;
+            case Pattern::Noise:
+                bits = Random(seed);
+                break;
+            case Pattern::Walk:
+                bits += (Random(seed) >> 24) - 128;
+                break;
+            case Pattern::Extremes:
+                bits = extremes[Random(seed) >> 30];
+                break;
+            case Pattern::Audio: {
+                const float phase = static_cast<float>(i % 400) / 200.f;
+                Storage::Store(dst[i], (phase < 1.f ? phase : 2.f - phase) * 1.8f - 0.9f, seed);
+                continue;
+            }
+            default:
+                break;
+        }
+        std::memcpy(dst + i, &bits, sizeof(Element));
+    }
+}
+
+// the number of failed round trips
+template<int numChannels, SampleStorageId storageId>
+static int Test(size_t numFrames) {
+    typedef SampleStorage<storageId> Storage;
+    typedef typename Storage::Element Element;
+    typedef PageCodec<numChannels, Element> Codec;
+    static constexpr uint8_t guard = 0xa5;
+
+    const size_t numSamples = numFrames * numChannels;
+    const size_t maxBytes = Codec::MaxEncodedBytes(numSamples);
+    std::vector<Element> page(numSamples);
+    std::vector<Element> decoded(numSamples);
+    std::vector<uint8_t> encoded(maxBytes + 16);
+    uint32_t seed = 1;
+    int numFailed = 0;
+    for (int p = 0; p < static_cast<int>(Pattern::Count); ++p) {
+        const auto pattern = static_cast<Pattern>(p);
+        const std::string name = std::string(SampleStorageIdLabel[static_cast<int>(storageId)]) + ", "
+                                 + std::to_string(numChannels) + " channel(s), " + std::to_string(numFrames)
+                                 + " frames, " + PatternLabel[p];
+        MakePage<Storage>(pattern, page.data(), numSamples, seed);
+        std::fill(encoded.begin(), encoded.end(), guard);
+        const size_t numBytes = Codec::Encode(page.data(), numFrames, encoded.data());
+        bool isGuardIntact = true;
+        for (size_t i = maxBytes; i < encoded.size(); ++i) {
+            isGuardIntact = isGuardIntact && encoded[i] == guard;
+        }
+        // (decoding writes over whatever was there, as it does in released memory)
+        std::memset(decoded.data(), 0x5a, numSamples * sizeof(Element));
+        Codec::Decode(encoded.data(), numFrames, decoded.data());
+
+        if (numBytes > maxBytes || !isGuardIntact) {
+            std::cerr << name << ": encoded to " << numBytes << " bytes, over the bound of " << maxBytes
+                      << std::endl;
+            numFailed++;
+        } else if (pattern == Pattern::Silence && numBytes != (numSamples + 1) / 2) {
+            std::cerr << name << ": encoded to " << numBytes << " bytes, not just the length tags" << std::endl;
+            numFailed++;
+        } else if (std::memcmp(page.data(), decoded.data(), numSamples * sizeof(Element)) != 0) {
+            size_t i = 0;
+            while (std::memcmp(&page[i], &decoded[i], sizeof(Element)) == 0) {
+                ++i;
+            }
+            std::cerr << name << ": decoded page differs at sample " << i << std::endl;
+            numFailed++;
+        }
+    }
+    return numFailed;
+}
+
+template<SampleStorageId storageId>
+static int TestStorage() {
+    // a whole page of stereo, and an odd number of mono samples, which leaves half a tag byte
+    return Test<2, storageId>(16384) + Test<1, storageId>(1001);
+}
+
+int main() {
+    const int numFailed = TestStorage<SampleStorageId::Float32>() + TestStorage<SampleStorageId::Float16>()
+                          + TestStorage<SampleStorageId::Int24>() + TestStorage<SampleStorageId::Int16>();
+    if (numFailed > 0) {
+        std::cerr << numFailed << " round trips failed" << std::endl;
+        return 1;
+    }
+    std::cout << "every page round-tripped" << std::endl;
+    return 0;
+}
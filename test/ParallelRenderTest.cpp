@@ -0,0 +1,53 @@
+// renders the same input and event script with layers processed serially and on worker threads,
+// at several block sizes, and checks that the outputs are bit-identical (see Kernel::ProcessSpanParallel)
+
+#include <iostream>
+
+#include "TestRender.hpp"
+
+using namespace test;
+
+static constexpr frame_t numFrames = 16384;
+
+// fill all four layers, so that blocks of 64 frames are worth splitting, then overdub and move levels
+static std::vector<Event> MakeScript() {
+    std::vector<Event> script{
+            {0, [](Mlp &m) {
+                m.IndexParamChange(Mlp::IndexParamId::Mode,
+                                   static_cast<unsigned long int>(LayerBehaviorModeId::MULTIPLY_UNQUANTIZED));
+            }},
+    };
+    frame_t time = 128;
+    for (frame_t loopFrames: {1024, 2048, 3072, 1536}) {
+        script.push_back({time, [](Mlp &m) { m.Tap(Mlp::TapId::Set); }});
+        time += loopFrames;
+        script.push_back({time, [](Mlp &m) { m.Tap(Mlp::TapId::Set); }});
+        time += 128;
+    }
+    script.push_back({time, [](Mlp &m) {
+        m.FloatParamChange(Mlp::FloatParamId::PreserveLevel, 0.7f);
+        m.IndexFloatParamChange(Mlp::IndexFloatParamId::LayerPlaybackLevel, 1, 0.4f);
+        m.IndexFloatParamChange(Mlp::IndexFloatParamId::LayerPan, 2, 0.9f);
+    }});
+    script.push_back({time + 1024, [](Mlp &m) { m.Tap(Mlp::TapId::Set); }});
+    script.push_back({time + 2048, [](Mlp &m) { m.Tap(Mlp::TapId::Stop); }});
+    return script;
+}
+
+int main() {
+    const std::vector<Event> script = MakeScript();
+    int numFailed = 0;
+    for (unsigned int blockFrames: {64u, 16u, 1u}) {
+        const std::vector<AudioSample> serial = Render(script, numFrames, blockFrames, 0);
+        const std::vector<AudioSample> parallel = Render(script, numFrames, blockFrames, 2);
+        const long int difference = FirstDifference(serial, parallel);
+        if (difference >= 0) {
+            std::cerr << "blocks of " << blockFrames << ": parallel output differs from serial at frame "
+                      << difference / numLoopChannels << ", channel " << difference % numLoopChannels << std::endl;
+            numFailed++;
+        } else {
+            std::cout << "blocks of " << blockFrames << ": parallel output matches serial" << std::endl;
+        }
+    }
+    return numFailed == 0 ? 0 : 1;
+}
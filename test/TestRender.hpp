@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Mlp.hpp"
+
+//-----------------------------------------------------------------------------------
+// offline rendering for tests: a fixed input signal and event script, rendered in blocks of a given size.
+// the input is made from integers, so that it is the same in any build
+namespace test {
+
+    using namespace mlp;
+
+    static constexpr float sampleRate = 48000.f;
+
+    struct Event {
+        // a multiple of every block size used, so that it lands on the same frame whatever the block size
+        frame_t time;
+        std::function<void(Mlp &)> apply;
+    };
+
+    inline float SampleFromRaw(float *, int32_t raw) {
+        return static_cast<float>(raw) * (1.f / 2147483648.f);
+    }
+
+    inline q31 SampleFromRaw(q31 *, int32_t raw) {
+        return q31::FromRaw(raw);
+    }
+
+    // a triangle wave, a slower one on the other channel, and a little noise on both
+    inline void MakeInput(frame_t startFrame, unsigned int numFrames, uint32_t &seed, AudioSample *dst) {
+        for (unsigned int i = 0; i < numFrames; ++i) {
+            const frame_t t = startFrame + i;
+            const int32_t phases[numLoopChannels] = {static_cast<int32_t>(t * 0x01000000u),
+                                                     static_cast<int32_t>(t * 0x00300000u)};
+            for (unsigned int ch = 0; ch < numLoopChannels; ++ch) {
+                seed = seed * 1664525u + 1013904223u;
+                const int32_t triangle = (phases[ch] < 0 ? ~phases[ch] : phases[ch]) - (1 << 30);
+                const int32_t noise = static_cast<int32_t>(seed) >> 8;
+                dst[i * numLoopChannels + ch] = SampleFromRaw(static_cast<AudioSample *>(nullptr),
+                                                              triangle / 2 + noise);
+            }
+        }
+    }
+
+    // render the script for the given number of frames, and return the interleaved output
+    inline std::vector<AudioSample> Render(const std::vector<Event> &script, frame_t numFrames,
+                                           unsigned int blockFrames, unsigned int numWorkers = 0) {
+        auto m = std::make_unique<Mlp>();
+        m->SetSampleRate(sampleRate);
+        m->SetLayerWorkers(numWorkers);
+        std::vector<AudioSample> in(blockFrames * numLoopChannels);
+        std::vector<AudioSample> out(numFrames * numLoopChannels);
+        uint32_t seed = 1;
+        size_t nextEvent = 0;
+        for (frame_t time = 0; time < numFrames; time += blockFrames) {
+            while (nextEvent < script.size() && script[nextEvent].time <= time) {
+                script[nextEvent++].apply(*m);
+            }
+            const auto n = static_cast<unsigned int>(std::min<frame_t>(blockFrames, numFrames - time));
+            MakeInput(time, n, seed, in.data());
+            m->ProcessAudioBlock(in.data(), out.data() + time * numLoopChannels, n);
+            // nobody is listening to the outputs; don't let them pile up
+            LayerFlagsMessageData flags;
+            while (m->GetLayerFlagsQ().try_dequeue(flags)) {}
+            LayerPositionMessageData position;
+            while (m->GetLayerPositionQ().try_dequeue(position)) {}
+        }
+        return out;
+    }
+
+    // index of the first sample that differs, or -1 if none do
+    inline long int FirstDifference(const std::vector<AudioSample> &a, const std::vector<AudioSample> &b) {
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+            if (std::memcmp(&a[i], &b[i], sizeof(AudioSample)) != 0) {
+                return static_cast<long int>(i);
+            }
+        }
+        return a.size() == b.size() ? -1 : static_cast<long int>(std::min(a.size(), b.size()));
+    }
+
+}